@@ -0,0 +1,15 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include "partitioner.hpp"
+
+// A partitioning algorithm under the name the command line tools use
+struct AlgoInfo {
+    const char* name;
+    void (Partitioner::*method)();
+};
+
+// Every algorithm, localized first and the rest by name
+const std::vector<AlgoInfo>& getAlgorithms();
+// nullptr for an unknown name
+const AlgoInfo* findAlgorithm(std::string_view name);
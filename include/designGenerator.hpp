@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "geom.hpp"
+#include "instanceGrid.hpp"
+#include "parallel.hpp"
+
+enum class PlacementModel {
+    Uniform,
+    GaussianClusters,
+};
+
+enum class BitsizeModel {
+    Uniform,      // 0..maxBitsize
+    HeavyTailed,  // mostly uniform, a few Pareto distributed large cells
+};
+
+// Description of a synthetic design
+struct DesignSpec {
+    size_t count = 100000;
+    BoundingBox area = BoundingBox(0.0f, 0.0f, 1000.0f, 1000.0f);
+
+    PlacementModel placement = PlacementModel::Uniform;
+    size_t clusterCount = 10;
+    float clusterStddev = 10.0f;
+    // Density grows linearly along x, the right edge is (1 + densityGradient)
+    // times as dense as the left one. Applies to cluster centers too.
+    float densityGradient = 0.0f;
+    // Macro blockages, no instance is placed inside one
+    std::vector<BoundingBox> blockages;
+
+    BitsizeModel bitsizes = BitsizeModel::Uniform;
+    unsigned int maxBitsize = 8;
+    float heavyTailFraction = 0.05f;
+    float heavyTailAlpha = 1.5f;
+    unsigned int heavyTailMax = 256;
+
+    size_t nameLength = 8;
+    std::uint64_t seed = 1;
+};
+
+// Instance i depends only on (seed, i), so the output is the same for any
+// thread count. Instances are generated in parallel chunks and written in order.
+bool writeDesignText(const DesignSpec& spec, const std::string& filename,
+                     size_t threadCount = getDefaultThreadCount());
+bool writeDesignBinary(const DesignSpec& spec, const std::string& filename,
+                       size_t threadCount = getDefaultThreadCount());
+// Appends the design to the grid
+void generateDesign(const DesignSpec& spec, InstanceGrid& grid,
+                    size_t threadCount = getDefaultThreadCount());
@@ -0,0 +1,28 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "instanceGrid.hpp"
+
+// One design binned at several sizes from a single load. Level 0 is the
+// finest grid and owns the instances; every coarser level bins factor x factor
+// finest bins together, shares the instances and stores only its bin index,
+// aggregated from the finest one. Every level is an InstanceGrid, so the
+// algorithms and queries work on it unchanged.
+class GridPyramid {
+public:
+    // Level i > 0 has bins of factors[i - 1] finest bins per side
+    GridPyramid(float finestBinSize, const std::vector<int>& factors);
+    GridPyramid(const GridPyramid&) = delete;
+    GridPyramid& operator=(const GridPyramid&) = delete;
+
+    // Load the design through any level. Changes through a level apply to
+    // the design, every level sees them on its next query.
+    InstanceGrid& getLevel(size_t level);
+    const InstanceGrid& getLevel(size_t level) const;
+    size_t getLevelCount() const { return levels.size(); }
+
+private:
+    InstanceGrid finest;
+    std::vector<std::unique_ptr<InstanceGrid>> coarser;
+    std::vector<InstanceGrid*> levels;
+};
@@ -1,13 +1,13 @@
 #pragma once
-#include <string>
 #include "geom.hpp"
+#include "nameArena.hpp"
 
 class Instance {
 public:
-    Instance(const std::string& name, float x, float y, unsigned int bitsize);
-    Instance(const std::string& name, const Point2D& location, unsigned int bitsize);
+    Instance(NameHandle name, float x, float y, unsigned int bitsize);
+    Instance(NameHandle name, const Point2D& location, unsigned int bitsize);
 
-    const std::string& getName() const;
+    NameHandle getName() const;
     float getX() const;
     float getY() const;
     const Point2D& getLocation() const;
@@ -20,7 +20,7 @@ public:
     bool operator<(const Instance& other) const;
 
 private:
-    std::string name;
+    NameHandle name;
     Point2D location;
     unsigned int bitsize;
 };
@@ -30,8 +30,8 @@ namespace std {
     template<>
     struct hash<Instance> {
         std::size_t operator()(const Instance& inst) const {
-            std::size_t h1 = std::hash<std::string>()(inst.getName());
-            return h1;
+            // Name hash is precomputed by the NameArena
+            return inst.getName().hash;
         }
     };
 };
\ No newline at end of file
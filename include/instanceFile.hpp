@@ -0,0 +1,92 @@
+#pragma once
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Binary instance file, native little-endian:
+//   InstanceFileHeader
+//   float x[count], float y[count], uint32 bitsize[count], uint32 nameIndex[count]
+//   uint32 nameHash[nameCount], uint64 nameOffset[nameCount + 1], char names[nameBytes]
+// Every block starts at the offset stored in the header, aligned to 8 bytes.
+// Names are stored once per distinct name, instances refer to them by index.
+struct InstanceFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint64_t count;
+    std::uint64_t nameCount;
+    std::uint64_t nameBytes;
+    std::uint64_t totalBitSize;
+    std::uint32_t maxBitSize;
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+    std::uint32_t reserved;
+    std::uint64_t xOffset;
+    std::uint64_t yOffset;
+    std::uint64_t bitsizeOffset;
+    std::uint64_t nameIndexOffset;
+    std::uint64_t nameHashOffset;
+    std::uint64_t nameOffsetsOffset;
+    std::uint64_t namesOffset;
+};
+
+constexpr char instanceFileMagic[8] = {'D', 'F', 'T', 'I', 'N', 'S', 'T', '\0'};
+constexpr std::uint32_t instanceFileVersion = 1;
+constexpr std::uint32_t instanceFileByteOrder = 0x01020304;
+
+// Header with magic, version and block offsets for a file of the given sizes.
+// Bounds and totals are left zero for the writer to fill in.
+InstanceFileHeader makeInstanceFileHeader(std::uint64_t count, std::uint64_t nameCount, std::uint64_t nameBytes);
+
+// Reads and validates only the header; gives bounds and totals without loading the design
+bool readInstanceFileHeader(const std::string& filename, InstanceFileHeader& header);
+// Header with bounds and totals recomputed from the columns, false when the
+// file is malformed or a coordinate is not finite
+bool readInstanceFileSummary(const std::string& filename, InstanceFileHeader& header);
+
+// Converts a "name x y bitsize" text file into the binary format
+bool convertInstanceTextToBinary(const std::string& textFile, const std::string& binaryFile);
+
+inline bool isInstanceLineBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parses one "name x y bitsize" text line starting at p and returns the start
+// of the next line. ok is false for a malformed line, anything after the
+// fourth field is ignored. name points into [p, end).
+inline const char* parseInstanceLine(const char* p, const char* end, std::string_view& name,
+                                     float& x, float& y, unsigned int& bitsize, bool& ok) {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (!eol) eol = end;
+    auto skipBlanks = [eol](const char* q) {
+        while (q != eol && isInstanceLineBlank(*q)) ++q;
+        return q;
+    };
+    // from_chars takes no leading '+', the stream reader did
+    auto skipToNumber = [eol, &skipBlanks](const char* q) {
+        q = skipBlanks(q);
+        if (q != eol && *q == '+' && q + 1 != eol && *(q + 1) != '-' && *(q + 1) != '+') ++q;
+        return q;
+    };
+
+    const char* q = skipBlanks(p);
+    const char* nameBegin = q;
+    while (q != eol && !isInstanceLineBlank(*q)) ++q;
+    name = std::string_view(nameBegin, q - nameBegin);
+
+    auto rx = std::from_chars(skipToNumber(q), eol, x);
+    ok = !name.empty() && rx.ec == std::errc();
+    if (ok) {
+        auto ry = std::from_chars(skipToNumber(rx.ptr), eol, y);
+        ok = ry.ec == std::errc();
+        if (ok) ok = std::from_chars(skipToNumber(ry.ptr), eol, bitsize).ec == std::errc();
+        // nan and inf parse as floats but cannot be binned
+        ok = ok && std::isfinite(x) && std::isfinite(y);
+    }
+    return eol == end ? end : eol + 1;
+}
@@ -1,48 +1,216 @@
 #pragma once
-#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
 #include "instance.hpp"
+#include "instanceTable.hpp"
 #include "geom.hpp"
 
-// Hash function for std::pair<int, int>
+// Hash function for std::pair<int, int>, used where bins are keyed by cell
 struct PairHash {
     std::size_t operator()(const std::pair<int, int>& p) const {
         return std::hash<int>()(p.first) ^ (std::hash<int>()(p.second) << 1);
     }
 };
 
+// Instances binned on a uniform grid. Bins are stored densely in compressed
+// form: one id array sorted by bin plus an offsets array over all bins of the
+// bounding box. Bins are laid out column by column, so a window spanning a few
+// columns is a few contiguous slices.
+// A grid can also be a level of a GridPyramid: it then shares the instances of
+// the pyramid's finest grid and only owns its bin index.
 class InstanceGrid {
 public:
     explicit InstanceGrid(float binSize);
 
-    void addInstance(const Instance& inst);
+    InstanceId addInstance(const Instance& inst);
+    InstanceId addInstance(std::string_view name, float x, float y, unsigned int bitsize);
+    NameHandle internName(std::string_view name);
+    // Room for count instances in total with nameBytes of names, before a bulk add
+    void reserve(size_t count, size_t nameBytes);
+    // Re-bins the instances, the index is rebuilt on the next query. A pyramid
+    // level takes the nearest multiple of the finest bin size.
+    void setBinSize(float size);
 
-    const std::vector<Instance>& getCellInstances(float x, float y) const;
-    std::vector<Instance> getCellInstancesWithin(const BoundingBox& bbox) const;
+    // Placement ECO updates. Ids stay valid: a removed instance keeps its row
+    // in the table but leaves its bin and the totals. Bounds only grow. Changes
+    // inside the indexed bins are patched into the index on the next query
+    // instead of rebuilding it.
+    void moveInstance(InstanceId id, float x, float y);
+    void removeInstance(InstanceId id);
+    bool isRemoved(InstanceId id) const {
+        const std::vector<char>& flags = base ? base->removed : removed;
+        return id < flags.size() && flags[id];
+    }
+
+    InstanceRange getCellInstances(float x, float y) const;
+    InstanceRange getBinInstances(int cx, int cy) const;
+    std::vector<InstanceId> getCellInstancesWithin(const BoundingBox& bbox) const;
+
+    // Calls fn(InstanceRange) for runs of instances inside bbox, in the same
+    // order as getCellInstancesWithin. Bins lying fully inside the box are
+    // passed as whole slices without testing each instance.
+    template<typename Fn>
+    void forEachRangeWithin(const BoundingBox& bbox, Fn&& fn) const;
+    // Calls fn(InstanceId) for every instance inside bbox, without allocating
+    template<typename Fn>
+    void forEachInstanceWithin(const BoundingBox& bbox, Fn&& fn) const;
+
+    // Sorts instances into bins; queries do this lazily after instances were added
+    void buildIndex() const;
 
     void readInstancesFromFile(const std::string& filename);
+    // Binary instance files, see instanceFile.hpp
+    bool readBinaryFile(const std::string& filename);
+    bool writeBinaryFile(const std::string& filename) const;
+    // Generators, the same non-zero seed always produces the same file.
+    // Seed 0 seeds from the clock.
     void generateRandomInstancesToFile(const std::string& filename, size_t count,
-                                       const BoundingBox& searchBox, size_t nameLength);
+                                       const BoundingBox& searchBox, size_t nameLength,
+                                       std::uint32_t seed = 0);
     void generateGaussianClustersToFile(const std::string& filename, size_t instanceCount,
                                 size_t clusterCount, const BoundingBox& area,
-                                float stddev, size_t nameLength);
+                                float stddev, size_t nameLength, std::uint32_t seed = 0);
 
     
     std::pair<int, int> getCell(const Point2D& p) const;
     
-    std::unordered_map<std::pair<int, int>, std::vector<Instance>, PairHash>& getGrid();
+    const InstanceTable& getInstances() const;
+    // All binned instances, ordered bin by bin
+    InstanceRange getBinnedInstances() const;
+    std::pair<int, int> getFirstCell() const;
+    int getBinCountX() const;
+    int getBinCountY() const;
     BoundingBox& getBounds();
-    float getBinSize();
-    unsigned int getMaxBitSize();
-    size_t getInstanceCount();
-    size_t getTotalBitSize();
+    const BoundingBox& getBounds() const;
+    float getBinSize() const;
+    unsigned int getMaxBitSize() const;
+    size_t getInstanceCount() const;
+    size_t getTotalBitSize() const;
     
 private:
-    std::unordered_map<std::pair<int, int>, std::vector<Instance>, PairHash> grid;
+    friend class GridPyramid;
+
+    // Pyramid level over base with bins of factor x factor base bins. Changes
+    // are applied to base, the level index is aggregated again after them.
+    InstanceGrid(InstanceGrid& base, int factor);
+    void aggregateIndex() const;
+
+    InstanceId placeInstance(InstanceId id);
+    // Bin of a cell in the current index, false when outside of it
+    bool getIndexedBin(const std::pair<int, int>& cell, std::uint32_t& bin) const;
+    void growBounds(float x, float y);
+    void patchIndex() const;
+
+    template<typename Pred, typename Fn>
+    static void forEachMatchingRun(const InstanceId* it, const InstanceId* end, Pred&& keep, Fn& fn);
+
+    InstanceTable instances;
+
+    // Compressed bin index, rebuilt on demand
+    mutable std::vector<InstanceId> binInstances;
+    mutable std::vector<std::uint32_t> binOffsets;
+    mutable int minCx = 0;
+    mutable int minCy = 0;
+    mutable int nx = 0;
+    mutable int ny = 0;
+    mutable bool indexDirty = false;
+    // Instances changed since the index was built, with the bin they are
+    // indexed in (noBin for new ones)
+    mutable std::vector<std::pair<InstanceId, std::uint32_t>> pendingChanges;
+    std::vector<char> removed;
+
     BoundingBox bounds;
     float binSize;
-    unsigned int maxBitSize = 0;
+    // An upper bound while maxBitSizeDirty, after the largest instance was removed
+    mutable unsigned int maxBitSize = 0;
+    mutable bool maxBitSizeDirty = false;
     size_t instanceCount = 0;
     size_t totalBitSize = 0;
-};
\ No newline at end of file
+
+    InstanceGrid* base = nullptr;
+    int factor = 1;
+    std::uint64_t revision = 0;  // bumped by every change of the instances or the bins
+    mutable std::uint64_t indexedRevision = 0;  // base revision the level index was built from
+};
+
+template<typename Pred, typename Fn>
+void InstanceGrid::forEachMatchingRun(const InstanceId* it, const InstanceId* end, Pred&& keep, Fn& fn) {
+    while (it != end) {
+        while (it != end && !keep(*it)) ++it;
+        const InstanceId* run = it;
+        while (it != end && keep(*it)) ++it;
+        if (run != it) fn(InstanceRange{run, it});
+    }
+}
+
+template<typename Fn>
+void InstanceGrid::forEachRangeWithin(const BoundingBox& bbox, Fn&& fn) const {
+    buildIndex();
+    // A bin strictly between the bins holding the box corners is inside the box on that axis
+    auto rawMin = getCell(bbox.ll);
+    auto rawMax = getCell(bbox.ur);
+    int rawMinX = rawMin.first, rawMaxX = rawMax.first;
+    int rawMinY = rawMin.second, rawMaxY = rawMax.second;
+    int cellMinX = std::max(minCx, rawMinX);
+    int cellMaxX = std::min(minCx + nx - 1, rawMaxX);
+    int cellMinY = std::max(minCy, rawMinY);
+    int cellMaxY = std::min(minCy + ny - 1, rawMaxY);
+    if (cellMinX > cellMaxX || cellMinY > cellMaxY) return;
+
+    const InstanceTable& table = getInstances();
+    auto insideX = [&](InstanceId id) {
+        float x = table.getX(id);
+        return x >= bbox.ll.x && x <= bbox.ur.x;
+    };
+    auto insideY = [&](InstanceId id) {
+        float y = table.getY(id);
+        return y >= bbox.ll.y && y <= bbox.ur.y;
+    };
+    auto insideXY = [&](InstanceId id) { return insideX(id) && insideY(id); };
+
+    int innerMinY = std::max(cellMinY, rawMinY + 1);
+    int innerMaxY = std::min(cellMaxY, rawMaxY - 1);
+    const InstanceId* base = binInstances.data();
+
+    for (int cx = cellMinX; cx <= cellMaxX; ++cx) {
+        bool fullX = cx > rawMinX && cx < rawMaxX;
+        size_t column = size_t(cx - minCx) * ny;
+        // Rows [from, to] of this column as one slice
+        auto slice = [&](int from, int to) {
+            return InstanceRange{base + binOffsets[column + (from - minCy)],
+                                 base + binOffsets[column + (to - minCy) + 1]};
+        };
+        auto edgeRows = [&](int from, int to) {
+            if (from > to) return;
+            InstanceRange rows = slice(from, to);
+            if (fullX) forEachMatchingRun(rows.first, rows.last, insideY, fn);
+            else forEachMatchingRun(rows.first, rows.last, insideXY, fn);
+        };
+
+        if (innerMinY > innerMaxY) {
+            edgeRows(cellMinY, cellMaxY);
+            continue;
+        }
+        edgeRows(cellMinY, innerMinY - 1);
+        InstanceRange inner = slice(innerMinY, innerMaxY);
+        if (fullX) {
+            if (!inner.empty()) fn(inner);
+        } else {
+            forEachMatchingRun(inner.first, inner.last, insideX, fn);
+        }
+        edgeRows(innerMaxY + 1, cellMaxY);
+    }
+}
+
+template<typename Fn>
+void InstanceGrid::forEachInstanceWithin(const BoundingBox& bbox, Fn&& fn) const {
+    forEachRangeWithin(bbox, [&fn](InstanceRange range) {
+        for (InstanceId id : range) fn(id);
+    });
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "geom.hpp"
+#include "instanceGrid.hpp"
+#include "instanceTable.hpp"
+
+// Density adaptive bins over the instances of an InstanceGrid, sharing its
+// table. A node is split into quadrants while it holds more than the target
+// bitsize, so dense regions get small leaves and sparse regions large ones.
+// Leaves are numbered along a Hilbert curve and every node owns one
+// contiguous slice of the id array, inside a leaf sorted by x then y.
+// The tree is a snapshot: rebuild it after the grid changes.
+class InstanceQuadtree {
+public:
+    struct Leaf {
+        BoundingBox box;  // quadrant of the leaf, not the instance bounds
+        std::uint32_t first = 0;
+        std::uint32_t last = 0;
+        std::uint64_t bitsize = 0;
+    };
+
+    InstanceQuadtree(const InstanceGrid& grid, unsigned int targetBitSize);
+
+    const std::vector<Leaf>& getLeaves() const { return leaves; }
+    InstanceRange getLeafInstances(size_t leaf) const {
+        return InstanceRange{ids.data() + leaves[leaf].first, ids.data() + leaves[leaf].last};
+    }
+    const InstanceTable& getInstances() const { return *table; }
+
+    // Calls fn(leaf index) for every leaf whose quadrant touches bbox, in leaf order
+    template<typename Fn>
+    void forEachLeafWithin(const BoundingBox& bbox, Fn&& fn) const;
+    // Calls fn(InstanceRange) for runs of instances inside bbox. Nodes lying
+    // fully inside the box are passed as whole slices.
+    template<typename Fn>
+    void forEachRangeWithin(const BoundingBox& bbox, Fn&& fn) const;
+    template<typename Fn>
+    void forEachInstanceWithin(const BoundingBox& bbox, Fn&& fn) const;
+
+private:
+    // Deeper nodes are not split, e.g. when many instances share a location
+    static constexpr int maxDepth = 24;
+    static constexpr std::uint32_t noNode = 0xFFFFFFFFu;
+
+    struct Node {
+        BoundingBox box;
+        std::uint32_t first = 0;
+        std::uint32_t last = 0;
+        std::uint32_t firstLeaf = 0;
+        std::uint32_t lastLeaf = 0;
+        bool isLeaf = false;
+        std::uint32_t children[4] = {noNode, noNode, noNode, noNode};  // in curve order
+    };
+
+    // Instance copy the tree is built on, so the splits read memory in order
+    struct Record {
+        float x;
+        float y;
+        unsigned int bitsize;
+        InstanceId id;
+    };
+
+    std::uint32_t build(std::vector<Record>& records, std::vector<Record>& scratch, std::uint32_t first,
+                        std::uint32_t last, std::uint64_t bitsize, const BoundingBox& box, int depth, int state);
+
+    template<typename Fn>
+    void forEachNodeWithin(const BoundingBox& bbox, Fn&& fn) const;
+
+    const InstanceTable* table;
+    std::uint64_t targetBitSize;
+    std::vector<InstanceId> ids;
+    std::vector<Node> nodes;  // root first when not empty
+    std::vector<Leaf> leaves;
+};
+
+// Calls fn(node, inside) for the nodes touching bbox in curve order. Nodes
+// with inside set lie fully in bbox and their children are not visited.
+template<typename Fn>
+void InstanceQuadtree::forEachNodeWithin(const BoundingBox& bbox, Fn&& fn) const {
+    if (nodes.empty()) return;
+    std::uint32_t stack[3 * maxDepth + 4];
+    size_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (node.box.ur.x < bbox.ll.x || node.box.ll.x > bbox.ur.x ||
+            node.box.ur.y < bbox.ll.y || node.box.ll.y > bbox.ur.y) continue;
+        bool inside = node.box.ll.x >= bbox.ll.x && node.box.ur.x <= bbox.ur.x &&
+                      node.box.ll.y >= bbox.ll.y && node.box.ur.y <= bbox.ur.y;
+        if (inside || node.isLeaf) {
+            fn(node, inside);
+            continue;
+        }
+        // Pushed in reverse so they pop in curve order
+        for (int k = 3; k >= 0; --k) {
+            if (node.children[k] != noNode) stack[top++] = node.children[k];
+        }
+    }
+}
+
+template<typename Fn>
+void InstanceQuadtree::forEachLeafWithin(const BoundingBox& bbox, Fn&& fn) const {
+    forEachNodeWithin(bbox, [&](const Node& node, bool) {
+        for (std::uint32_t leaf = node.firstLeaf; leaf < node.lastLeaf; ++leaf) fn(size_t(leaf));
+    });
+}
+
+template<typename Fn>
+void InstanceQuadtree::forEachRangeWithin(const BoundingBox& bbox, Fn&& fn) const {
+    forEachNodeWithin(bbox, [&](const Node& node, bool inside) {
+        const InstanceId* it = ids.data() + node.first;
+        const InstanceId* end = ids.data() + node.last;
+        if (inside) {
+            if (it != end) fn(InstanceRange{it, end});
+            return;
+        }
+        auto keep = [&](InstanceId id) {
+            float x = table->getX(id), y = table->getY(id);
+            return x >= bbox.ll.x && x <= bbox.ur.x && y >= bbox.ll.y && y <= bbox.ur.y;
+        };
+        while (it != end) {
+            while (it != end && !keep(*it)) ++it;
+            const InstanceId* run = it;
+            while (it != end && keep(*it)) ++it;
+            if (run != it) fn(InstanceRange{run, it});
+        }
+    });
+}
+
+template<typename Fn>
+void InstanceQuadtree::forEachInstanceWithin(const BoundingBox& bbox, Fn&& fn) const {
+    forEachRangeWithin(bbox, [&fn](InstanceRange range) {
+        for (InstanceId id : range) fn(id);
+    });
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <string_view>
+#include <vector>
+#include "geom.hpp"
+#include "nameArena.hpp"
+
+// Index of an instance inside an InstanceTable
+using InstanceId = std::uint32_t;
+
+// Non-owning contiguous slice of instance ids
+struct InstanceRange {
+    const InstanceId* first = nullptr;
+    const InstanceId* last = nullptr;
+
+    const InstanceId* begin() const { return first; }
+    const InstanceId* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    InstanceId operator[](size_t i) const { return first[i]; }
+};
+
+// Structure-of-arrays store for every instance of a design.
+// Columns are indexed by InstanceId, names are interned in a NameArena.
+class InstanceTable {
+public:
+    InstanceId add(std::string_view name, float x, float y, unsigned int bitsize);
+    InstanceId add(NameHandle name, float x, float y, unsigned int bitsize);
+    void reserve(size_t count, size_t nameBytes);
+    void clear();
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    // Accessors are inline, they sit in the inner loops of every algorithm
+    float getX(InstanceId id) const { return x[id]; }
+    float getY(InstanceId id) const { return y[id]; }
+    Point2D getLocation(InstanceId id) const { return Point2D(x[id], y[id]); }
+    unsigned int getBitsize(InstanceId id) const { return bitsize[id]; }
+    NameHandle getNameHandle(InstanceId id) const { return names[id]; }
+    std::string_view getName(InstanceId id) const { return arena.getName(names[id]); }
+    void setLocation(InstanceId id, float newX, float newY) { x[id] = newX; y[id] = newY; }
+    const NameArena& getNames() const { return arena; }
+    NameArena& getNames() { return arena; }
+
+    // Raw columns, used to serialise the table
+    const float* getXs() const { return x.data(); }
+    const float* getYs() const { return y.data(); }
+    const unsigned int* getBitsizes() const { return bitsize.data(); }
+    const NameHandle* getNameHandles() const { return names.data(); }
+    // Replaces all instances; nameIndex refers to names already in the arena
+    void assign(const float* xs, const float* ys, const unsigned int* bitsizes,
+                const std::uint32_t* nameIndex, size_t count);
+
+    // Manhattan distance between two instances
+    float distance(InstanceId a, InstanceId b) const {
+        return std::fabs(x[a] - x[b]) + std::fabs(y[a] - y[b]);
+    }
+
+private:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<unsigned int> bitsize;
+    std::vector<NameHandle> names;
+    NameArena arena;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compact reference to a name interned in a NameArena.
+// Equal names share one index, so equality is an integer compare.
+struct NameHandle {
+    std::uint32_t index = 0;
+    std::uint32_t hash = 0;
+
+    bool operator==(const NameHandle& other) const { return index == other.index; }
+    bool operator!=(const NameHandle& other) const { return index != other.index; }
+};
+
+// Interns names into one contiguous buffer with precomputed hashes
+class NameArena {
+public:
+    NameArena();
+
+    static std::uint32_t hashName(std::string_view name);
+
+    NameHandle intern(std::string_view name);
+    // Same as above when the caller already hashed the name (e.g. in a parser thread)
+    NameHandle intern(std::string_view name, std::uint32_t hash);
+    std::optional<NameHandle> find(std::string_view name) const;
+
+    std::string_view getName(NameHandle handle) const {
+        return std::string_view(buffer.data() + offsets[handle.index],
+                                offsets[handle.index + 1] - offsets[handle.index]);
+    }
+
+    NameHandle getHandle(std::uint32_t index) const { return NameHandle{index, hashes[index]}; }
+
+    size_t size() const { return hashes.size(); }
+    size_t getByteSize() const { return buffer.size(); }
+    void reserve(size_t count, size_t bytes);
+    void clear();
+
+    // Raw storage, used to serialise the arena
+    const std::string& getBuffer() const { return buffer; }
+    const std::vector<std::uint64_t>& getOffsets() const { return offsets; }
+    const std::vector<std::uint32_t>& getHashes() const { return hashes; }
+    // Replaces the contents with already interned names (count + 1 offsets)
+    void assign(std::string_view names, const std::uint64_t* nameOffsets,
+                const std::uint32_t* nameHashes, size_t count);
+
+private:
+    void rehash(size_t slotCount);
+
+    std::string buffer;
+    std::vector<std::uint64_t> offsets;  // size() + 1 entries
+    std::vector<std::uint32_t> hashes;
+    std::vector<std::uint32_t> slots;    // open addressing, stores index + 1, 0 is empty
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller does not choose one
+inline size_t getDefaultThreadCount() {
+    size_t count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+// Runs fn(i) for every i in [0, count) on up to threadCount threads.
+// The calling thread takes part, indices are handed out dynamically.
+template<typename Fn>
+void parallelFor(size_t count, size_t threadCount, Fn&& fn) {
+    threadCount = std::min(threadCount, count);
+    if (threadCount <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) fn(i);
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (size_t t = 1; t < threadCount; ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads) thread.join();
+}
+
+// Fixed set of worker threads running queued tasks. The thread calling wait()
+// runs tasks too, so a pool of one thread executes everything inline in wait().
+// Tasks may submit further tasks.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadCount = getDefaultThreadCount());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t getThreadCount() const { return workers.size() + 1; }
+
+    void submit(std::function<void()> task);
+    // Blocks until every submitted task has finished
+    void wait();
+
+    // Runs fn(i) for every i in [0, count) and waits for completion
+    template<typename Fn>
+    void parallelFor(size_t count, Fn&& fn) {
+        size_t taskCount = std::min(count, getThreadCount());
+        std::atomic<size_t> next(0);
+        for (size_t t = 0; t < taskCount; ++t) {
+            submit([&]() {
+                for (size_t i = next++; i < count; i = next++) fn(i);
+            });
+        }
+        wait();
+    }
+
+private:
+    bool runOne(std::unique_lock<std::mutex>& lock);
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable waiters;  // woken on new tasks and on completion
+    size_t running = 0;
+    bool stopping = false;
+};
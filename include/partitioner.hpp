@@ -1,43 +1,208 @@
 #pragma once
-#include <QWidget>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
 #include <vector>
-#include <unordered_set>
-#include "instance.hpp"
+#include "instanceTable.hpp"
 #include "instanceGrid.hpp"
+#include "routingMetrics.hpp"
+
+class InstanceQuadtree;
+
+// Result of Partitioner::validate
+struct PartitionValidation {
+    size_t missedInstances = 0;     // grid instances in no partition
+    size_t duplicateInstances = 0;  // extra occurrences of instances already placed
+    size_t removedInstances = 0;    // removed instances still in a partition
+    std::vector<size_t> overLimitPartitions;  // indices above the bitsize limit
+    std::vector<size_t> emptyPartitions;
+
+    bool isValid() const {
+        return missedInstances == 0 && duplicateInstances == 0 && removedInstances == 0 && overLimitPartitions.empty();
+    }
+};
+
+// Result of Partitioner::partitionLocalizedStreaming
+struct StreamingPartitionStats {
+    bool ok = false;  // false when the input or a spill or output file failed
+    size_t instanceCount = 0;
+    size_t partitionCount = 0;
+    size_t bandCount = 0;
+    size_t windowCount = 0;
+    size_t bandsPerWindow = 0;  // bands resident at once
+    size_t peakResidentInstances = 0;  // largest window plus the carried leftovers
+    size_t overLimitPartitions = 0;
+};
+
+// One placement ECO change, see Partitioner::repairPartitions
+struct InstanceDelta {
+    enum class Kind { Add, Remove, Move };
+    Kind kind = Kind::Move;
+    InstanceId id = 0;         // Remove and Move
+    std::string name;          // Add
+    float x = 0, y = 0;        // Add and Move
+    unsigned int bitsize = 0;  // Add
+};
+
+// Result of Partitioner::repairPartitions
+struct EcoRepairStats {
+    size_t dirtyBins = 0;
+    size_t touchedPartitions = 0;    // partitions whose membership changed
+    size_t reassignedInstances = 0;  // moved instances that left their partition
+    size_t newPartitions = 0;
+    std::vector<InstanceId> addedIds;  // ids of the Add deltas, in delta order
+};
+
+// Result of Partitioner::refinePartitions
+struct RefinementStats {
+    size_t rounds = 0;
+    size_t pairsTried = 0;
+    size_t pairsImproved = 0;
+    size_t movedInstances = 0;
+    double lengthBefore = 0;  // nearest neighbour routing length
+    double lengthAfter = 0;
+    bool budgetExhausted = false;
+};
+
+// One bin size considered by Partitioner::tuneLocalizedBinSize
+struct BinSizeCandidate {
+    float binSize = 0;
+    double predictedMs = 0;    // partitionLocalized on the whole design
+    double predictedLoss = 0;  // route length above the best candidate, as a fraction
+    double sampledMs = -1;     // trial run on the sample, -1 when not run
+    double sampledLength = -1;
+};
+
+// Result of Partitioner::tuneLocalizedBinSize
+struct BinSizeTuning {
+    float binSize = 0;
+    size_t sampleInstances = 0;  // 0 without trial runs
+    std::vector<BinSizeCandidate> candidates;  // finest first
+};
 
 class Partitioner {
 public:
     class Partition {
         public:
-            void addInstance(Instance inst);
-            void removeInstance(Instance inst);
-            const float getTotalRoutingDistance();
+            explicit Partition(const InstanceTable& table);
+
+            // Both keep the statistics below up to date in O(1). The first few
+            // removals search the instance, later ones index the positions,
+            // so removal stays O(1) amortised. It does not keep the order.
+            void addInstance(InstanceId id);
+            void removeInstance(InstanceId id);
+            // Sum of the distances from each instance to its nearest neighbour
+            float getTotalRoutingDistance() const;
+
+            // Bounding box of the instances, recomputed lazily after a removal on its edge
+            const BoundingBox& getBoundingBox() const;
+            // Number of instances with the given bitsize
+            unsigned int getBitsizeCount(unsigned int bitsize) const;
+            unsigned int getMaxInstanceBitsize() const;
+            // totalBitsize relative to the limit
+            float getFillLevel(unsigned int bitsizeLimit) const;
 
-            std::unordered_set<Instance> instances;
+            std::vector<InstanceId> instances;
             unsigned int totalBitsize = 0;
+            // Center of weight (weighted by bitsize), the plain mean when all bitsizes are 0
             Point2D centerLoc = Point2D(0, 0);
+
+        private:
+            void updateCenter();
+
+            const InstanceTable* table;
+            // Running sums, in double so long add/remove sequences do not drift
+            double sumWeightedX = 0, sumWeightedY = 0;
+            double sumX = 0, sumY = 0;
+            std::vector<unsigned int> bitsizeCounts;
+            // Position of each instance in instances, empty until indexed
+            std::unordered_map<InstanceId, std::uint32_t> slots;
+            unsigned int searchedRemovals = 0;
+            mutable BoundingBox bbox;
+            mutable bool bboxDirty = false;
     };
 
     Partitioner(InstanceGrid& grid, unsigned int bitsizeLimit);
 
+    // Worker threads used by the parallel algorithms, results do not depend on it
+    void setThreadCount(size_t count);
+
     // Performs the partitioning
+    void partitionBisection();
     void partitionHashmap();
+    void partitionHilbert();
     void partitionLocalized();
     void partitionNearby();
     void partitionMerging();
+    void partitionMultilevel();
+    void partitionQuadtree();
 
-    float getPartitionsTotalRoutingLength();
+    // Out-of-core partitionLocalized for designs that do not fit in memory.
+    // Buckets the text or binary instance file into row band spill files in
+    // spillDir, partitions a window of bands at a time and carries only the
+    // band leftovers. Writes the same "name partition" lines, in the same
+    // order, as partitionLocalized on the loaded design. A window holds
+    // windowBands bands (0 for the default), more only when the design has
+    // too many bands for the open spill files; threads work within a window.
+    static StreamingPartitionStats partitionLocalizedStreaming(const std::string& input, const std::string& output,
+                                                               float binSize, unsigned int bitsizeLimit,
+                                                               const std::string& spillDir, size_t threadCount,
+                                                               size_t windowBands = 0);
+
+    // Bin size for partitionLocalized on the grid: the lowest predicted route
+    // length whose predicted runtime fits budgetMs (0 for no budget). The
+    // predictions come from a density histogram of the design. With runTrials
+    // every candidate is also run on a window of the design, which replaces
+    // the modelled loss and calibrates the modelled runtime.
+    static BinSizeTuning tuneLocalizedBinSize(const InstanceGrid& grid, unsigned int bitsizeLimit,
+                                              double budgetMs, bool runTrials, size_t threadCount);
+
+    // Post-pass for any algorithm: moves and swaps instances between adjacent
+    // partitions while that shortens the routing and respects the limit.
+    // Partition pairs that share no partition are refined concurrently. Stops
+    // when no pair improves or after about budgetSeconds.
+    RefinementStats refinePartitions(double budgetSeconds);
+
+    // Replaces the partitions, e.g. with a previous result read back from disk
+    void setPartitions(const std::vector<std::vector<InstanceId>>& assignment);
+    // Applies a placement ECO to the grid and repairs the current partitions
+    // around the changed bins only. Untouched partitions keep their membership
+    // and index, partitions left empty stay in place.
+    EcoRepairStats repairPartitions(const std::vector<InstanceDelta>& deltas);
+
+    // Routing estimates, the partitions are scored in parallel
+    float getPartitionsTotalRoutingLength() const;
+    RoutingMetrics getRoutingMetrics() const;
+    std::vector<RoutingMetrics> getPartitionRoutingMetrics() const;
     float getPartitionAverageBitSize();
-    size_t getViolatingBitLimitPartitionCount();
+    size_t getViolatingBitLimitPartitionCount() const;
     size_t countGridInstancesMissedInPartitions() const;
+    // Checks coverage, duplicates, bitsize limits and empty partitions in one parallel pass
+    PartitionValidation validate() const;
 
     // Returns the created partitions
     const std::vector<Partition>& getPartitions();
 
 private:
+    // Row bands of partitionLocalized, 0 when the limit is 0
+    static size_t getLocalizedBandCount(const BoundingBox& bounds, size_t totalBitSize,
+                                        unsigned int maxBitSize, unsigned int bitsizeLimit);
+    static BoundingBox getLocalizedBand(const BoundingBox& bounds, size_t bandCount, size_t band);
+    void sweepLocalizedBand(const BoundingBox& band, bool ownsBottomEdge, unsigned int fillThreshold,
+                            std::vector<Partition>& out, std::vector<InstanceId>& leftovers) const;
+    void sweepQuadtreeBand(const InstanceQuadtree& tree, const BoundingBox& band, bool ownsBottomEdge,
+                           unsigned int fillThreshold, std::vector<Partition>& out,
+                           std::vector<InstanceId>& leftovers) const;
+    void packLocalizedReminders(const std::vector<InstanceId>& leftovers, unsigned int fillThreshold,
+                                std::vector<Partition>& out) const;
+    void packQuadtreeReminders(const InstanceQuadtree& tree, const std::vector<InstanceId>& leftovers,
+                               unsigned int fillThreshold, std::vector<Partition>& out) const;
+
     InstanceGrid& grid;
     unsigned int bitsizeLimit;
+    size_t threadCount;
     std::vector<Partition> partitions;
-    
+
 };
 
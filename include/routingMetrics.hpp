@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "instanceTable.hpp"
+
+// Routing length estimates for one group of instances (or a sum over groups)
+struct RoutingMetrics {
+    // Sum over instances of the Manhattan distance to the nearest other instance
+    double nearestNeighbour = 0;
+    // Length of the rectilinear minimum spanning tree
+    double spanningTree = 0;
+    // Half perimeter of the bounding box
+    double halfPerimeter = 0;
+
+    RoutingMetrics& operator+=(const RoutingMetrics& other) {
+        nearestNeighbour += other.nearestNeighbour;
+        spanningTree += other.spanningTree;
+        halfPerimeter += other.halfPerimeter;
+        return *this;
+    }
+};
+
+// Nearest neighbour sum using a small uniform grid over the instances, O(k) on average
+double measureNearestNeighbourLength(const InstanceTable& table, const InstanceId* ids, size_t count);
+// Rectilinear MST: dense Prim for small groups, otherwise Kruskal over the
+// octant sweep candidate edges, O(k log k)
+double measureSpanningTreeLength(const InstanceTable& table, const InstanceId* ids, size_t count);
+double measureHalfPerimeter(const InstanceTable& table, const InstanceId* ids, size_t count);
+
+RoutingMetrics measureRouting(const InstanceTable& table, const std::vector<InstanceId>& ids);
@@ -1,20 +1,60 @@
 #pragma once
-#include <QWidget>
+#include <QImage>
 #include <QPainter>
+#include <QPoint>
+#include <QPointF>
+#include <QPolygonF>
+#include <QWidget>
+#include <cstdint>
 #include <vector>
-#include <unordered_set>
-#include "instance.hpp"
 #include "instanceGrid.hpp"
+#include "parallel.hpp"
 #include "partitioner.hpp"
 
+// Draws the instances coloured by partition, with pan (drag) and zoom (wheel).
+// The instances are rasterised once into an image pyramid. Zoomed out the
+// partitions are drawn as hulls and centroids, zoomed far in the visible
+// instances are drawn one by one. Grid and partitions are referenced, not
+// copied, and must outlive the widget. The raster and the hulls are built on
+// threadCount threads.
 class DotWidget : public QWidget {
 public:
-    explicit DotWidget(InstanceGrid & grid, std::vector<Partitioner::Partition> partitions, QWidget* parent = nullptr);
+    DotWidget(const InstanceGrid& grid, const std::vector<Partitioner::Partition>& partitions,
+              size_t threadCount, QWidget* parent = nullptr);
 
 protected:
     void paintEvent(QPaintEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void mouseMoveEvent(QMouseEvent* event) override;
+    void mouseDoubleClickEvent(QMouseEvent* event) override;
 
 private:
-    std::vector<Partitioner::Partition> partitions;
-    InstanceGrid& grid;
+    void buildPartitionIndex();
+    void buildRasterPyramid();
+    void buildHulls();
+
+    float getScale() const;
+    QPointF toScreen(float x, float y) const;
+    QPointF toWorld(const QPointF& p) const;
+    BoundingBox getVisibleBox() const;
+
+    void drawRaster(QPainter& painter, const BoundingBox& visible);
+    void drawHulls(QPainter& painter, const BoundingBox& visible);
+    void drawInstances(QPainter& painter, const BoundingBox& visible);
+
+    const InstanceGrid& grid;
+    const std::vector<Partitioner::Partition>& partitions;
+    BoundingBox bounds;
+    ThreadPool pool;
+
+    std::vector<std::uint32_t> partitionOf;  // per instance, noPartition when unassigned
+    std::vector<QImage> pyramid;             // level 0 is the finest
+    float pyramidScale = 1.0f;               // level 0 pixels per design unit
+    std::vector<QPolygonF> hulls;
+    float partitionExtent = 0.0f;            // typical partition size in design units
+
+    QPointF viewCenter;  // design coordinates shown at the widget centre
+    float zoom = 1.0f;   // relative to fitting the whole design
+    QPointF lastMouse;
 };
@@ -0,0 +1,22 @@
+#include "algorithms.hpp"
+
+const std::vector<AlgoInfo>& getAlgorithms() {
+    static const std::vector<AlgoInfo> algorithms = {
+        {"localized", &Partitioner::partitionLocalized},
+        {"bisection", &Partitioner::partitionBisection},
+        {"hashmap",   &Partitioner::partitionHashmap},
+        {"hilbert",   &Partitioner::partitionHilbert},
+        {"merging",   &Partitioner::partitionMerging},
+        {"multilevel", &Partitioner::partitionMultilevel},
+        {"nearby",    &Partitioner::partitionNearby},
+        {"quadtree",  &Partitioner::partitionQuadtree},
+    };
+    return algorithms;
+}
+
+const AlgoInfo* findAlgorithm(std::string_view name) {
+    for (const auto& algo : getAlgorithms()) {
+        if (name == algo.name) return &algo;
+    }
+    return nullptr;
+}
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <designGenerator.hpp>
+#include <instanceFile.hpp>
+#include <instanceGrid.hpp>
+#include "algorithms.hpp"
+#include "partitioner.hpp"
+
+// Reproducible benchmark sweep. Designs are generated from fixed seeds and
+// cached as binary files, every configuration runs several trials and the
+// results are written as JSON. --compare checks them against a baseline.
+
+namespace {
+
+struct BenchConfig {
+    std::vector<size_t> counts = {10000, 100000, 1000000, 10000000};
+    std::vector<std::string> distributions = {"uniform", "clusters"};
+    std::vector<float> grids = {1.0f, 10.0f};
+    std::vector<unsigned int> limits = {1000, 4000};
+    std::vector<std::string> algorithms = {"localized", "hashmap", "merging", "nearby"};
+    size_t trials = 5;
+    std::uint32_t seed = 1;
+    std::string cacheDir = "bench_cache";
+    std::string outputFile;
+    std::string compareFile;
+    double timeTolerance = 0.10;     // relative slowdown flagged as a regression
+    double timeSlackMs = 1.0;        // ignored absolute noise on short runs
+    double routingTolerance = 0.01;  // relative routing length increase
+};
+
+// One line of the JSON report
+struct BenchResult {
+    std::string algorithm;
+    std::string distribution;
+    size_t instances = 0;
+    float grid = 0;
+    unsigned int limit = 0;
+    size_t trials = 0;
+    double medianMs = 0;
+    double p95Ms = 0;
+    double routingLength = 0;
+    size_t partitions = 0;
+    bool valid = false;
+
+    std::string key() const {
+        std::ostringstream s;
+        s << algorithm << '/' << distribution << '/' << instances << '/' << grid << '/' << limit;
+        return s.str();
+    }
+};
+
+template<typename T>
+std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        std::istringstream itemIn(item);
+        T value;
+        if (itemIn >> value) values.push_back(value);
+    }
+    return values;
+}
+
+long peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(std::ceil(p * values.size())) - 1;
+    return values[std::min(index, values.size() - 1)];
+}
+
+// Design for a named distribution. About one instance per unit area, so the
+// grid sizes mean the same thing at every count.
+bool makeDesignSpec(const std::string& distribution, size_t count, std::uint32_t seed, DesignSpec& spec) {
+    float side = std::sqrt(static_cast<float>(count));
+    spec.count = count;
+    spec.area = BoundingBox(0.0f, 0.0f, side, side);
+    spec.seed = seed;
+    spec.clusterCount = std::max<size_t>(10, count / 10000);
+    spec.clusterStddev = side / 20;
+    if (distribution == "uniform") {
+        spec.placement = PlacementModel::Uniform;
+    } else if (distribution == "clusters") {
+        spec.placement = PlacementModel::GaussianClusters;
+    } else if (distribution == "blockages") {
+        // Clusters around a few macros covering about a fifth of the die
+        spec.placement = PlacementModel::GaussianClusters;
+        spec.blockages = {
+            BoundingBox(0.10f * side, 0.10f * side, 0.35f * side, 0.40f * side),
+            BoundingBox(0.55f * side, 0.60f * side, 0.90f * side, 0.80f * side),
+            BoundingBox(0.60f * side, 0.05f * side, 0.70f * side, 0.45f * side),
+        };
+    } else if (distribution == "gradient") {
+        spec.placement = PlacementModel::Uniform;
+        spec.densityGradient = 4.0f;
+    } else if (distribution == "heavytail") {
+        spec.placement = PlacementModel::GaussianClusters;
+        spec.bitsizes = BitsizeModel::HeavyTailed;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Generates (or reuses) the design as a binary file
+std::string prepareDesign(const BenchConfig& config, const std::string& distribution, size_t count) {
+    mkdir(config.cacheDir.c_str(), 0755);
+    std::string binaryFile = config.cacheDir + "/" + distribution + "_" + std::to_string(count) +
+                             "_" + std::to_string(config.seed) + ".bin";
+    InstanceFileHeader header;
+    if (readInstanceFileHeader(binaryFile, header)) return binaryFile;
+
+    DesignSpec spec;
+    if (!makeDesignSpec(distribution, count, config.seed, spec)) {
+        std::cerr << "Unknown distribution " << distribution << "\n";
+        std::exit(2);
+    }
+    writeDesignBinary(spec, binaryFile);
+    return binaryFile;
+}
+
+// The peak RSS is the process high-water mark, so it is one figure for the
+// whole sweep rather than a field of each result
+void writeJson(std::ostream& out, const std::vector<BenchResult>& results, long peakRssKb) {
+    out << "{\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    {\"algorithm\": \"" << r.algorithm << "\""
+            << ", \"distribution\": \"" << r.distribution << "\""
+            << ", \"instances\": " << r.instances
+            << ", \"grid\": " << r.grid
+            << ", \"limit\": " << r.limit
+            << ", \"trials\": " << r.trials
+            << ", \"medianMs\": " << r.medianMs
+            << ", \"p95Ms\": " << r.p95Ms
+            << ", \"routingLength\": " << r.routingLength
+            << ", \"partitions\": " << r.partitions
+            << ", \"valid\": " << (r.valid ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"peakRssKb\": " << peakRssKb << "\n}\n";
+}
+
+// Reads back the flat objects written by writeJson
+std::vector<BenchResult> readJson(const std::string& filename) {
+    std::ifstream in(filename);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+
+    std::vector<BenchResult> results;
+    size_t pos = text.find('[');
+    while (pos != std::string::npos) {
+        size_t open = text.find('{', pos);
+        if (open == std::string::npos) break;
+        size_t close = text.find('}', open);
+        if (close == std::string::npos) break;
+
+        std::map<std::string, std::string> fields;
+        std::istringstream object(text.substr(open + 1, close - open - 1));
+        std::string field;
+        while (std::getline(object, field, ',')) {
+            size_t colon = field.find(':');
+            if (colon == std::string::npos) continue;
+            auto trim = [](std::string s) {
+                size_t b = s.find_first_not_of(" \t\n\r\"");
+                size_t e = s.find_last_not_of(" \t\n\r\"");
+                return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+            };
+            fields[trim(field.substr(0, colon))] = trim(field.substr(colon + 1));
+        }
+
+        BenchResult r;
+        r.algorithm = fields["algorithm"];
+        r.distribution = fields["distribution"];
+        r.instances = std::strtoull(fields["instances"].c_str(), nullptr, 10);
+        r.grid = std::strtof(fields["grid"].c_str(), nullptr);
+        r.limit = std::strtoul(fields["limit"].c_str(), nullptr, 10);
+        r.trials = std::strtoull(fields["trials"].c_str(), nullptr, 10);
+        r.medianMs = std::strtod(fields["medianMs"].c_str(), nullptr);
+        r.p95Ms = std::strtod(fields["p95Ms"].c_str(), nullptr);
+        r.routingLength = std::strtod(fields["routingLength"].c_str(), nullptr);
+        r.partitions = std::strtoull(fields["partitions"].c_str(), nullptr, 10);
+        r.valid = fields["valid"] == "true";
+        results.push_back(r);
+        pos = close;
+    }
+    return results;
+}
+
+// Prints regressions against the baseline, returns how many were found
+size_t compareResults(const BenchConfig& config, const std::vector<BenchResult>& baseline,
+                      const std::vector<BenchResult>& results) {
+    std::map<std::string, BenchResult> byKey;
+    for (const auto& r : baseline) byKey[r.key()] = r;
+
+    size_t regressions = 0;
+    for (const auto& r : results) {
+        auto it = byKey.find(r.key());
+        if (it == byKey.end()) {
+            std::cerr << "new       " << r.key() << "\n";
+            continue;
+        }
+        const BenchResult& b = it->second;
+        std::vector<std::string> problems;
+        if (r.medianMs > b.medianMs * (1 + config.timeTolerance) + config.timeSlackMs) {
+            problems.push_back("median " + std::to_string(b.medianMs) + " -> " + std::to_string(r.medianMs) + " ms");
+        }
+        if (r.routingLength > b.routingLength * (1 + config.routingTolerance)) {
+            problems.push_back("routing " + std::to_string(b.routingLength) + " -> " + std::to_string(r.routingLength));
+        }
+        if (b.valid && !r.valid) problems.push_back("validation failed");
+
+        if (problems.empty()) {
+            std::cerr << "ok        " << r.key() << " (" << b.medianMs << " -> " << r.medianMs << " ms)\n";
+        } else {
+            ++regressions;
+            std::cerr << "REGRESSED " << r.key() << ":";
+            for (const auto& p : problems) std::cerr << " " << p << ";";
+            std::cerr << "\n";
+        }
+    }
+    return regressions;
+}
+
+std::string joinNames(const std::vector<std::string>& names) {
+    std::string text;
+    for (const auto& name : names) text += (text.empty() ? "" : ",") + name;
+    return text;
+}
+
+void printUsage(const char* program) {
+    std::vector<std::string> names;
+    for (const auto& algo : getAlgorithms()) names.push_back(algo.name);
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --counts N,N,...         instance counts (default 10000,100000,1000000,10000000)\n"
+              << "  --distributions D,...    uniform, clusters, blockages, gradient, heavytail\n"
+              << "                           (default uniform,clusters)\n"
+              << "  --grids G,...            grid bin sizes (default 1,10)\n"
+              << "  --limits L,...           bitsize limits (default 1000,4000)\n"
+              << "  --algorithms A,...       " << joinNames(names) << "\n"
+              << "                           (default " << joinNames(BenchConfig().algorithms) << ")\n"
+              << "  --trials N               runs per configuration (default 5)\n"
+              << "  --seed N                 design seed (default 1)\n"
+              << "  --cache DIR              generated designs (default bench_cache)\n"
+              << "  --output FILE            JSON report (default stdout)\n"
+              << "  --compare FILE           flag regressions against a baseline report\n"
+              << "  --tolerance X            allowed relative slowdown (default 0.10)\n"
+              << "  --quick                  10k and 100k instances, 3 trials\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--counts") config.counts = parseList<size_t>(value());
+        else if (arg == "--distributions") config.distributions = parseList<std::string>(value());
+        else if (arg == "--grids") config.grids = parseList<float>(value());
+        else if (arg == "--limits") config.limits = parseList<unsigned int>(value());
+        else if (arg == "--algorithms") config.algorithms = parseList<std::string>(value());
+        else if (arg == "--trials") config.trials = std::max<size_t>(1, std::strtoull(value().c_str(), nullptr, 10));
+        else if (arg == "--seed") config.seed = std::strtoul(value().c_str(), nullptr, 10);
+        else if (arg == "--cache") config.cacheDir = value();
+        else if (arg == "--output") config.outputFile = value();
+        else if (arg == "--compare") config.compareFile = value();
+        else if (arg == "--tolerance") config.timeTolerance = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--quick") {
+            config.counts = {10000, 100000};
+            config.trials = 3;
+        } else {
+            printUsage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 2;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for (const auto& distribution : config.distributions) {
+        for (size_t count : config.counts) {
+            std::string design = prepareDesign(config, distribution, count);
+            // Loaded once, every grid size re-bins the same instances
+            InstanceGrid grid(config.grids.empty() ? 1.0f : config.grids.front());
+            if (!grid.readBinaryFile(design)) {
+                std::cerr << "Could not load " << design << "\n";
+                return 1;
+            }
+            for (float gridSize : config.grids) {
+                grid.setBinSize(gridSize);
+                grid.buildIndex();
+                for (unsigned int limit : config.limits) {
+                    for (const auto& algoName : config.algorithms) {
+                        const AlgoInfo* algo = findAlgorithm(algoName);
+                        if (!algo) {
+                            std::cerr << "Unknown algorithm " << algoName << "\n";
+                            return 2;
+                        }
+
+                        BenchResult r;
+                        r.algorithm = algo->name;
+                        r.distribution = distribution;
+                        r.instances = grid.getInstanceCount();
+                        r.grid = gridSize;
+                        r.limit = limit;
+                        r.trials = config.trials;
+
+                        std::vector<double> times;
+                        for (size_t t = 0; t < config.trials; ++t) {
+                            Partitioner partitioner(grid, limit);
+                            auto t1 = std::chrono::steady_clock::now();
+                            (partitioner.*algo->method)();
+                            auto t2 = std::chrono::steady_clock::now();
+                            times.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+                            if (t + 1 == config.trials) {
+                                r.routingLength = partitioner.getPartitionsTotalRoutingLength();
+                                r.partitions = partitioner.getPartitions().size();
+                                r.valid = partitioner.validate().isValid();
+                            }
+                        }
+                        r.medianMs = percentile(times, 0.5);
+                        r.p95Ms = percentile(times, 0.95);
+                        results.push_back(r);
+                        std::cerr << r.key() << ": " << r.medianMs << " ms\n";
+                    }
+                }
+            }
+        }
+    }
+
+    long peakKb = peakRssKb();
+    std::cerr << "peak RSS: " << peakKb << " kB\n";
+    if (config.outputFile.empty()) {
+        writeJson(std::cout, results, peakKb);
+    } else {
+        std::ofstream out(config.outputFile);
+        writeJson(out, results, peakKb);
+    }
+
+    if (!config.compareFile.empty()) {
+        std::vector<BenchResult> baseline = readJson(config.compareFile);
+        if (baseline.empty()) {
+            std::cerr << "No results in " << config.compareFile << "\n";
+            return 2;
+        }
+        size_t regressions = compareResults(config, baseline, results);
+        std::cerr << regressions << " regression(s)\n";
+        return regressions ? 1 : 0;
+    }
+    return 0;
+}
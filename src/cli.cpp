@@ -0,0 +1,286 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <instanceFile.hpp>
+#include <instanceGrid.hpp>
+#include "algorithms.hpp"
+#include "parallel.hpp"
+#include "partitioner.hpp"
+
+// Batch front end: reads an instance file, runs one algorithm and writes the
+// assignment. No GUI, suitable for headless nodes.
+
+namespace {
+
+void printUsage(const char* program) {
+    std::string algorithmList;
+    for (const auto& algo : getAlgorithms()) algorithmList += (algorithmList.empty() ? "" : ",") + std::string(algo.name);
+    std::cerr << "Usage: " << program << " <instances> [options]\n"
+              << "  <instances>            text (name x y bitsize) or binary instance file\n"
+              << "  -a, --algorithm NAME   one of " << algorithmList << "\n"
+              << "                         (default localized)\n"
+              << "  -g, --grid SIZE        grid bin size (default 1.0), or auto to pick it for\n"
+              << "                         localized from the instance density\n"
+              << "      --grid-budget MS   with -g auto, best bin size whose predicted run fits MS\n"
+              << "      --grid-trials      with -g auto, check the candidates on a sample of the design\n"
+              << "  -l, --limit BITS       partition bitsize limit (default 1000)\n"
+              << "  -t, --threads N        worker threads (default: all cores)\n"
+              << "  -o, --output FILE      write one \"name partition\" line per instance\n"
+              << "  -r, --refine SECONDS   refine the partition boundaries for up to SECONDS\n"
+              << "  -e, --eco FILE         apply a placement ECO after partitioning and repair the\n"
+              << "                         partitions (lines: move NAME X Y, add NAME X Y BITS, remove NAME)\n"
+              << "  -s, --stream           localized only, partition out of core through band\n"
+              << "                         spill files instead of loading the design (needs -o)\n"
+              << "      --spill-dir DIR    directory for the spill files (default .)\n"
+              << "      --window-bands N   with -s, row bands held in memory at once (default 8)\n";
+}
+
+// Reads "move NAME X Y", "add NAME X Y BITS" and "remove NAME" lines. Names
+// not in the grid are reported and skipped.
+bool readEcoFile(const std::string& filename, const InstanceGrid& grid, std::vector<InstanceDelta>& deltas) {
+    std::ifstream in(filename);
+    if (!in) return false;
+    const InstanceTable& table = grid.getInstances();
+    std::vector<InstanceId> byName(table.getNames().size(), std::numeric_limits<InstanceId>::max());
+    for (InstanceId id = 0; id < table.size(); ++id) {
+        if (!grid.isRemoved(id)) byName[table.getNameHandle(id).index] = id;
+    }
+    auto lookup = [&](const std::string& name, InstanceId& id) {
+        auto handle = table.getNames().find(name);
+        if (handle) id = byName[handle->index];
+        if (!handle || id == std::numeric_limits<InstanceId>::max()) {
+            std::cerr << "ECO: unknown instance " << name << "\n";
+            return false;
+        }
+        return true;
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string command;
+        InstanceDelta delta;
+        if (!(fields >> command >> delta.name)) continue;
+        if (command == "move" && fields >> delta.x >> delta.y) {
+            delta.kind = InstanceDelta::Kind::Move;
+            if (lookup(delta.name, delta.id)) deltas.push_back(delta);
+        } else if (command == "add" && fields >> delta.x >> delta.y >> delta.bitsize) {
+            delta.kind = InstanceDelta::Kind::Add;
+            deltas.push_back(delta);
+        } else if (command == "remove") {
+            delta.kind = InstanceDelta::Kind::Remove;
+            if (lookup(delta.name, delta.id)) deltas.push_back(delta);
+        } else {
+            std::cerr << "ECO: skipping malformed line: " << line << "\n";
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string inputFile, outputFile, ecoFile;
+    std::string algorithmName = "localized";
+    std::string spillDir = ".";
+    bool stream = false;
+    bool autoGrid = false;
+    bool gridTrials = false;
+    double gridBudgetMs = 0;
+    float binSize = 1.0f;
+    unsigned int bitsizeLimit = 1000;
+    size_t threadCount = 0;
+    size_t windowBands = 0;
+    double refineSeconds = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "-a" || arg == "--algorithm") algorithmName = value();
+        else if (arg == "-g" || arg == "--grid") {
+            std::string size = value();
+            autoGrid = size == "auto";
+            if (!autoGrid) binSize = std::strtof(size.c_str(), nullptr);
+        }
+        else if (arg == "--grid-budget") gridBudgetMs = std::strtod(value(), nullptr);
+        else if (arg == "--grid-trials") gridTrials = true;
+        else if (arg == "-l" || arg == "--limit") bitsizeLimit = std::strtoul(value(), nullptr, 10);
+        else if (arg == "-t" || arg == "--threads") threadCount = std::strtoul(value(), nullptr, 10);
+        else if (arg == "-o" || arg == "--output") outputFile = value();
+        else if (arg == "-r" || arg == "--refine") refineSeconds = std::strtod(value(), nullptr);
+        else if (arg == "-e" || arg == "--eco") ecoFile = value();
+        else if (arg == "-s" || arg == "--stream") stream = true;
+        else if (arg == "--spill-dir") spillDir = value();
+        else if (arg == "--window-bands") windowBands = std::strtoul(value(), nullptr, 10);
+        else if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (inputFile.empty() && arg[0] != '-') inputFile = arg;
+        else {
+            std::cerr << "Unknown argument " << arg << "\n";
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    const AlgoInfo* algo = findAlgorithm(algorithmName);
+    if (inputFile.empty() || !algo || !(binSize > 0) || bitsizeLimit == 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+
+    if (stream) {
+        if (std::string(algo->name) != "localized" || outputFile.empty() || autoGrid) {
+            printUsage(argv[0]);
+            return 2;
+        }
+        StreamingPartitionStats stats = Partitioner::partitionLocalizedStreaming(
+            inputFile, outputFile, binSize, bitsizeLimit, spillDir, threadCount ? threadCount : getDefaultThreadCount(),
+            windowBands);
+        std::chrono::duration<double, std::milli> runMs = clock::now() - t0;
+        if (!stats.ok) {
+            std::cerr << "Streaming partitioning of " << inputFile << " failed\n";
+            return 1;
+        }
+        std::cout << "algorithm:  localized (streaming)\n"
+                  << "instances:  " << stats.instanceCount << "\n"
+                  << "partitions: " << stats.partitionCount << "\n"
+                  << "bands:      " << stats.bandCount << " in " << stats.windowCount << " windows of "
+                  << stats.bandsPerWindow << "\n"
+                  << "resident:   " << stats.peakResidentInstances << " instances at most\n"
+                  << "run (ms):   " << runMs.count() << "\n"
+                  << "over limit: " << stats.overLimitPartitions << "\n";
+        return stats.overLimitPartitions == 0 ? 0 : 1;
+    }
+
+    InstanceGrid grid(binSize);
+    InstanceFileHeader header;
+    if (readInstanceFileHeader(inputFile, header)) {
+        if (!grid.readBinaryFile(inputFile)) {
+            std::cerr << "Could not read " << inputFile << "\n";
+            return 1;
+        }
+    } else {
+        grid.readInstancesFromFile(inputFile);
+    }
+    if (grid.getInstanceCount() == 0) {
+        std::cerr << "No instances read from " << inputFile << "\n";
+        return 1;
+    }
+
+    auto t1 = clock::now();
+    BinSizeTuning tuning;
+    std::chrono::duration<double, std::milli> tuneMs(0);
+    if (autoGrid) {
+        tuning = Partitioner::tuneLocalizedBinSize(grid, bitsizeLimit, gridBudgetMs, gridTrials,
+                                                   threadCount ? threadCount : getDefaultThreadCount());
+        grid.setBinSize(tuning.binSize);
+        tuneMs = clock::now() - t1;
+        t1 = clock::now();
+    }
+    Partitioner partitioner(grid, bitsizeLimit);
+    if (threadCount) partitioner.setThreadCount(threadCount);
+    (partitioner.*algo->method)();
+    auto t2 = clock::now();
+
+    RefinementStats refinement;
+    std::chrono::duration<double, std::milli> refineMs(0);
+    if (refineSeconds > 0) {
+        refinement = partitioner.refinePartitions(refineSeconds);
+        refineMs = clock::now() - t2;
+    }
+
+    EcoRepairStats eco;
+    size_t ecoDeltas = 0;
+    std::chrono::duration<double, std::milli> ecoMs(0);
+    if (!ecoFile.empty()) {
+        std::vector<InstanceDelta> deltas;
+        if (!readEcoFile(ecoFile, grid, deltas)) {
+            std::cerr << "Could not read " << ecoFile << "\n";
+            return 1;
+        }
+        ecoDeltas = deltas.size();
+        auto t3 = clock::now();
+        eco = partitioner.repairPartitions(deltas);
+        ecoMs = clock::now() - t3;
+    }
+
+    // getPartitions() throws on an empty result
+    PartitionValidation validation = partitioner.validate();
+    if (grid.getInstanceCount() > 0 && validation.missedInstances == grid.getInstanceCount()) {
+        std::cerr << algo->name << " partitioned none of the " << grid.getInstanceCount() << " instances\n";
+        return 1;
+    }
+    const auto& partitions = partitioner.getPartitions();
+    RoutingMetrics routing = partitioner.getRoutingMetrics();
+
+    std::chrono::duration<double, std::milli> loadMs = t1 - t0, runMs = t2 - t1;
+    std::cout << "algorithm:  " << algo->name << "\n"
+              << "instances:  " << grid.getInstanceCount() << "\n"
+              << "partitions: " << partitions.size() << " (" << validation.emptyPartitions.size() << " empty)\n"
+              << "load (ms):  " << loadMs.count() << "\n"
+              << "run (ms):   " << runMs.count() << "\n"
+              << "route len:  " << routing.nearestNeighbour << "\n"
+              << "mst len:    " << routing.spanningTree << "\n"
+              << "hpwl:       " << routing.halfPerimeter << "\n"
+              << "missed:     " << validation.missedInstances << "\n"
+              << "duplicated: " << validation.duplicateInstances << "\n"
+              << "removed:    " << validation.removedInstances << "\n"
+              << "over limit: " << validation.overLimitPartitions.size() << "\n";
+    if (autoGrid) {
+        std::cout << "tune (ms):  " << tuneMs.count() << "\n"
+                  << "grid:       " << grid.getBinSize() << "\n";
+        if (tuning.sampleInstances > 0) std::cout << "sample:     " << tuning.sampleInstances << " instances\n";
+        for (const BinSizeCandidate& candidate : tuning.candidates) {
+            std::cout << "  grid " << candidate.binSize << ": " << candidate.predictedMs << " ms, loss "
+                      << 100 * candidate.predictedLoss << "%";
+            if (candidate.sampledMs >= 0) {
+                std::cout << " (sample " << candidate.sampledMs << " ms, route len " << candidate.sampledLength << ")";
+            }
+            std::cout << "\n";
+        }
+    }
+    if (refineSeconds > 0) {
+        std::cout << "refine (ms): " << refineMs.count() << (refinement.budgetExhausted ? " (budget spent)" : "") << "\n"
+                  << "rounds:     " << refinement.rounds << "\n"
+                  << "improved:   " << refinement.pairsImproved << " of " << refinement.pairsTried << " pairs, "
+                  << refinement.movedInstances << " instances moved\n"
+                  << "route len before refine: " << refinement.lengthBefore << "\n";
+    }
+    if (!ecoFile.empty()) {
+        std::cout << "eco deltas: " << ecoDeltas << "\n"
+                  << "eco (ms):   " << ecoMs.count() << "\n"
+                  << "dirty bins: " << eco.dirtyBins << "\n"
+                  << "touched:    " << eco.touchedPartitions << " partitions, " << eco.newPartitions << " new\n"
+                  << "reassigned: " << eco.reassignedInstances << "\n";
+    }
+
+    if (!outputFile.empty()) {
+        std::ofstream out(outputFile);
+        const InstanceTable& table = grid.getInstances();
+        for (size_t i = 0; i < partitions.size(); ++i) {
+            for (InstanceId id : partitions[i].instances) {
+                out << table.getName(id) << ' ' << i << '\n';
+            }
+        }
+        if (!out) {
+            std::cerr << "Could not write " << outputFile << "\n";
+            return 1;
+        }
+    }
+
+    return validation.isValid() ? 0 : 1;
+}
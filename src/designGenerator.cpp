@@ -0,0 +1,282 @@
+#include "designGenerator.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include "instanceFile.hpp"
+
+namespace {
+
+constexpr size_t chunkSize = 1 << 16;
+
+// Counter based generator: a SplitMix64 stream keyed by (seed, counter),
+// so every instance has its own independent stream
+class CounterRng {
+public:
+    CounterRng(std::uint64_t seed, std::uint64_t counter)
+        : state(mix(seed ^ mix(counter + 0x632be59bd9b4e019ull))) {}
+
+    std::uint64_t next() {
+        state += 0x9e3779b97f4a7c15ull;
+        return mix(state);
+    }
+    // [0, 1)
+    float uniform() { return (next() >> 40) * (1.0f / (1u << 24)); }
+    float normal() {
+        float u = 1.0f - uniform();
+        float v = uniform();
+        return std::sqrt(-2.0f * std::log(u)) * std::cos(6.28318530718f * v);
+    }
+
+private:
+    static std::uint64_t mix(std::uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t state;
+};
+
+// Instances [begin, end) of the design, names are nameLength bytes each
+struct GeneratedChunk {
+    size_t begin = 0;
+    std::string names;
+    std::vector<std::uint32_t> nameHashes;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<unsigned int> bitsize;
+};
+
+class DesignSampler {
+public:
+    explicit DesignSampler(const DesignSpec& spec) : spec(spec) {
+        // Cluster centers use their own stream, after the instance counters
+        for (size_t c = 0; c < spec.clusterCount; ++c) {
+            CounterRng rng(spec.seed, ~std::uint64_t(0) - c);
+            centers.push_back(samplePlacement(rng));
+        }
+        // Names encode a permutation of the index in base 26, using as many
+        // bits as nameLength letters can hold
+        std::uint64_t letters = 1;
+        for (size_t j = 0; j < spec.nameLength && letters <= (std::uint64_t(1) << 62); ++j) letters *= 26;
+        while (nameBits < 63 && (std::uint64_t(2) << nameBits) <= letters) ++nameBits;
+        nameMask = (std::uint64_t(1) << nameBits) - 1;
+        nameKey = CounterRng(spec.seed, ~std::uint64_t(0) - spec.clusterCount).next();
+    }
+
+    // Names are unique as long as the design has at most this many instances
+    std::uint64_t getUniqueNameCount() const { return nameMask + 1; }
+
+    void generate(size_t begin, size_t end, GeneratedChunk& out) const {
+        size_t count = end - begin;
+        out.begin = begin;
+        out.names.resize(count * spec.nameLength);
+        out.nameHashes.resize(count);
+        out.x.resize(count);
+        out.y.resize(count);
+        out.bitsize.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            CounterRng rng(spec.seed, begin + i);
+            Point2D p = sampleInstance(rng);
+            out.x[i] = p.x;
+            out.y[i] = p.y;
+            out.bitsize[i] = sampleBitsize(rng);
+
+            char* name = &out.names[i * spec.nameLength];
+            std::uint64_t value = permuteName(begin + i);
+            for (size_t j = spec.nameLength; j-- > 0;) {
+                name[j] = static_cast<char>('a' + value % 26);
+                value /= 26;
+            }
+            out.nameHashes[i] = NameArena::hashName(std::string_view(name, spec.nameLength));
+        }
+    }
+
+private:
+    // Bijection on [0, 2^nameBits): xor, odd multiply and xorshift rounds
+    std::uint64_t permuteName(std::uint64_t index) const {
+        std::uint64_t x = index & nameMask;
+        for (int round = 0; round < 3; ++round) {
+            x = (x ^ (nameKey >> (round * 8))) & nameMask;
+            x = (x * 0x9e3779b97f4a7c15ull) & nameMask;
+            x ^= x >> (nameBits / 2 + 1);
+        }
+        return x;
+    }
+
+    bool isFree(float x, float y) const {
+        const BoundingBox& a = spec.area;
+        if (x < a.ll.x || x > a.ur.x || y < a.ll.y || y > a.ur.y) return false;
+        for (const auto& b : spec.blockages) {
+            if (x > b.ll.x && x < b.ur.x && y > b.ll.y && y < b.ur.y) return false;
+        }
+        return true;
+    }
+
+    // Inverse CDF of the density 1 + g * u on [0, 1]
+    float sampleGradient(float v) const {
+        float g = spec.densityGradient;
+        if (g == 0.0f) return v;
+        float u = (std::sqrt(1.0f + 2.0f * g * v * (1.0f + g / 2.0f)) - 1.0f) / g;
+        return std::min(std::max(u, 0.0f), 1.0f);
+    }
+
+    Point2D samplePlacement(CounterRng& rng) const {
+        const BoundingBox& a = spec.area;
+        Point2D p;
+        for (int attempt = 0; attempt < 64; ++attempt) {
+            p.x = a.ll.x + sampleGradient(rng.uniform()) * (a.ur.x - a.ll.x);
+            p.y = a.ll.y + rng.uniform() * (a.ur.y - a.ll.y);
+            if (isFree(p.x, p.y)) break;
+        }
+        return p;
+    }
+
+    Point2D sampleInstance(CounterRng& rng) const {
+        if (spec.placement == PlacementModel::GaussianClusters && !centers.empty()) {
+            for (int attempt = 0; attempt < 64; ++attempt) {
+                const Point2D& c = centers[rng.next() % centers.size()];
+                Point2D p(c.x + rng.normal() * spec.clusterStddev, c.y + rng.normal() * spec.clusterStddev);
+                if (isFree(p.x, p.y)) return p;
+            }
+        }
+        // Uniform background, also the fallback for clusters stuck in blockages
+        return samplePlacement(rng);
+    }
+
+    unsigned int sampleBitsize(CounterRng& rng) const {
+        if (spec.bitsizes == BitsizeModel::HeavyTailed && rng.uniform() < spec.heavyTailFraction) {
+            // Pareto above the regular range
+            float scale = static_cast<float>(spec.maxBitsize + 1);
+            float value = scale * std::pow(1.0f - rng.uniform(), -1.0f / spec.heavyTailAlpha);
+            return static_cast<unsigned int>(std::min(value, static_cast<float>(spec.heavyTailMax)));
+        }
+        return static_cast<unsigned int>(rng.next() % (spec.maxBitsize + 1));
+    }
+
+    const DesignSpec& spec;
+    std::vector<Point2D> centers;
+    unsigned int nameBits = 0;
+    std::uint64_t nameMask = 0;
+    std::uint64_t nameKey = 0;
+};
+
+// Generates the design in batches of parallel chunks and hands the chunks
+// to sink in instance order. Memory stays bounded by one batch.
+template<typename Sink>
+void generateInOrder(const DesignSpec& spec, const DesignSampler& sampler, size_t threadCount, Sink&& sink) {
+    ThreadPool pool(threadCount);
+    size_t chunkCount = (spec.count + chunkSize - 1) / chunkSize;
+    size_t batchSize = pool.getThreadCount() * 2;
+    std::vector<GeneratedChunk> batch(batchSize);
+    for (size_t first = 0; first < chunkCount; first += batchSize) {
+        size_t inBatch = std::min(batchSize, chunkCount - first);
+        pool.parallelFor(inBatch, [&](size_t j) {
+            size_t begin = (first + j) * chunkSize;
+            sampler.generate(begin, std::min(begin + chunkSize, spec.count), batch[j]);
+        });
+        for (size_t j = 0; j < inBatch; ++j) sink(batch[j]);
+    }
+}
+
+// "name x y bitsize" lines, floats in their shortest round-trip form
+void formatChunk(const GeneratedChunk& chunk, size_t nameLength, std::string& out) {
+    out.resize(chunk.x.size() * (nameLength + 48));
+    char* p = out.data();
+    char* end = out.data() + out.size();
+    for (size_t i = 0; i < chunk.x.size(); ++i) {
+        p = std::copy_n(chunk.names.data() + i * nameLength, nameLength, p);
+        *p++ = ' ';
+        p = std::to_chars(p, end, chunk.x[i]).ptr;
+        *p++ = ' ';
+        p = std::to_chars(p, end, chunk.y[i]).ptr;
+        *p++ = ' ';
+        p = std::to_chars(p, end, chunk.bitsize[i]).ptr;
+        *p++ = '\n';
+    }
+    out.resize(p - out.data());
+}
+
+}
+
+bool writeDesignText(const DesignSpec& spec, const std::string& filename, size_t threadCount) {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    std::string text;
+    generateInOrder(spec, DesignSampler(spec), threadCount, [&](const GeneratedChunk& chunk) {
+        formatChunk(chunk, spec.nameLength, text);
+        out.write(text.data(), text.size());
+    });
+    return static_cast<bool>(out);
+}
+
+// Streams the columns straight into their blocks. Every name is unique, so
+// name i is instance i and nothing needs to be interned.
+bool writeDesignBinary(const DesignSpec& spec, const std::string& filename, size_t threadCount) {
+    DesignSampler sampler(spec);
+    if (spec.count > sampler.getUniqueNameCount() || spec.count > std::numeric_limits<InstanceId>::max()) {
+        // Names repeat, go through the name arena
+        InstanceGrid grid(1.0f);
+        generateDesign(spec, grid, threadCount);
+        return grid.writeBinaryFile(filename);
+    }
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    InstanceFileHeader h = makeInstanceFileHeader(spec.count, spec.count, spec.count * spec.nameLength);
+    auto writeAt = [&out](std::uint64_t offset, const void* data, size_t bytes) {
+        out.seekp(static_cast<std::streamoff>(offset));
+        out.write(static_cast<const char*>(data), bytes);
+    };
+
+    std::vector<std::uint32_t> nameIndex;
+    std::vector<std::uint64_t> nameOffsets;
+    generateInOrder(spec, sampler, threadCount, [&](const GeneratedChunk& chunk) {
+        size_t n = chunk.x.size();
+        for (size_t i = 0; i < n; ++i) {
+            float x = chunk.x[i], y = chunk.y[i];
+            if (chunk.begin + i == 0) {
+                h.minX = h.maxX = x;
+                h.minY = h.maxY = y;
+            } else {
+                h.minX = std::min(h.minX, x);
+                h.maxX = std::max(h.maxX, x);
+                h.minY = std::min(h.minY, y);
+                h.maxY = std::max(h.maxY, y);
+            }
+            h.totalBitSize += chunk.bitsize[i];
+            h.maxBitSize = std::max(h.maxBitSize, chunk.bitsize[i]);
+        }
+        nameIndex.resize(n);
+        nameOffsets.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            nameIndex[i] = static_cast<std::uint32_t>(chunk.begin + i);
+            nameOffsets[i] = (chunk.begin + i) * spec.nameLength;
+        }
+        writeAt(h.xOffset + chunk.begin * sizeof(float), chunk.x.data(), n * sizeof(float));
+        writeAt(h.yOffset + chunk.begin * sizeof(float), chunk.y.data(), n * sizeof(float));
+        writeAt(h.bitsizeOffset + chunk.begin * sizeof(std::uint32_t), chunk.bitsize.data(), n * sizeof(std::uint32_t));
+        writeAt(h.nameIndexOffset + chunk.begin * sizeof(std::uint32_t), nameIndex.data(), n * sizeof(std::uint32_t));
+        writeAt(h.nameHashOffset + chunk.begin * sizeof(std::uint32_t), chunk.nameHashes.data(), n * sizeof(std::uint32_t));
+        writeAt(h.nameOffsetsOffset + chunk.begin * sizeof(std::uint64_t), nameOffsets.data(), n * sizeof(std::uint64_t));
+        writeAt(h.namesOffset + chunk.begin * spec.nameLength, chunk.names.data(), chunk.names.size());
+    });
+    std::uint64_t endOffset = h.nameBytes;
+    writeAt(h.nameOffsetsOffset + spec.count * sizeof(std::uint64_t), &endOffset, sizeof(endOffset));
+    writeAt(0, &h, sizeof(h));
+    return static_cast<bool>(out);
+}
+
+void generateDesign(const DesignSpec& spec, InstanceGrid& grid, size_t threadCount) {
+    grid.reserve(grid.getInstances().size() + spec.count,
+                 grid.getInstances().getNames().getByteSize() + spec.count * spec.nameLength);
+    generateInOrder(spec, DesignSampler(spec), threadCount, [&](const GeneratedChunk& chunk) {
+        for (size_t i = 0; i < chunk.x.size(); ++i) {
+            std::string_view name(chunk.names.data() + i * spec.nameLength, spec.nameLength);
+            grid.addInstance(name, chunk.x[i], chunk.y[i], chunk.bitsize[i]);
+        }
+    });
+    grid.buildIndex();
+}
@@ -0,0 +1,17 @@
+#include "gridPyramid.hpp"
+
+GridPyramid::GridPyramid(float finestBinSize, const std::vector<int>& factors) : finest(finestBinSize) {
+    levels.push_back(&finest);
+    for (int factor : factors) {
+        coarser.emplace_back(new InstanceGrid(finest, factor));
+        levels.push_back(coarser.back().get());
+    }
+}
+
+InstanceGrid& GridPyramid::getLevel(size_t level) {
+    return *levels[level];
+}
+
+const InstanceGrid& GridPyramid::getLevel(size_t level) const {
+    return *levels[level];
+}
@@ -1,13 +1,13 @@
 #include "instance.hpp"
 #include <cmath>
 
-Instance::Instance(const std::string& name, float x, float y, unsigned int bitsize)
+Instance::Instance(NameHandle name, float x, float y, unsigned int bitsize)
     : name(name), location(x, y), bitsize(bitsize) {}
 
-Instance::Instance(const std::string& name, const Point2D& location, unsigned int bitsize)
+Instance::Instance(NameHandle name, const Point2D& location, unsigned int bitsize)
     : name(name), location(location), bitsize(bitsize) {}
 
-const std::string& Instance::getName() const {
+NameHandle Instance::getName() const {
     return name;
 }
 
@@ -1,90 +1,341 @@
 #include "instanceGrid.hpp"
 #include <fstream>
-#include <sstream>
 #include <random>
 #include <chrono>
 #include <cmath>
 #include <algorithm>
+#include <limits>
+
+namespace {
+constexpr std::uint32_t noBin = std::numeric_limits<std::uint32_t>::max();
+
+int floorDiv(int a, int b) {
+    return a / b - (a % b != 0 && a < 0);
+}
+}
 
 // Constructor
 InstanceGrid::InstanceGrid(float binSize)
-    : binSize(binSize), bounds(BoundingBox(Point2D(0, 0), Point2D(0, 0))) {}
-
-// Add an instance and update bounds
-void InstanceGrid::addInstance(const Instance& inst) {
-    if (grid.empty()) {
-        bounds.ll.x = bounds.ur.x = inst.getX();
-        bounds.ll.y = bounds.ur.y = inst.getY();
-        maxBitSize = inst.getBitsize();
-        totalBitSize = inst.getBitsize();
+    : bounds(BoundingBox(Point2D(0, 0), Point2D(0, 0))), binSize(binSize) {}
+
+InstanceGrid::InstanceGrid(InstanceGrid& base, int factor)
+    : indexDirty(true), bounds(base.bounds), binSize(base.binSize * std::max(1, factor)), base(&base),
+      factor(std::max(1, factor)) {}
+
+// Add an instance whose name is interned in this grid's name arena
+InstanceId InstanceGrid::addInstance(const Instance& inst) {
+    if (base) return base->addInstance(inst);
+    return placeInstance(instances.add(inst.getName(), inst.getX(), inst.getY(), inst.getBitsize()));
+}
+
+// Intern the name and add an instance
+InstanceId InstanceGrid::addInstance(std::string_view name, float x, float y, unsigned int bitsize) {
+    if (base) return base->addInstance(name, x, y, bitsize);
+    return placeInstance(instances.add(name, x, y, bitsize));
+}
+
+NameHandle InstanceGrid::internName(std::string_view name) {
+    if (base) return base->internName(name);
+    return instances.getNames().intern(name);
+}
+
+void InstanceGrid::reserve(size_t count, size_t nameBytes) {
+    if (base) return base->reserve(count, nameBytes);
+    instances.reserve(count, nameBytes);
+}
+
+// Update bounds and bin the instance that was just appended to the table
+InstanceId InstanceGrid::placeInstance(InstanceId id) {
+    float x = instances.getX(id);
+    float y = instances.getY(id);
+    unsigned int bitsize = instances.getBitsize(id);
+    if (instanceCount == 0) {
+        bounds.ll.x = bounds.ur.x = x;
+        bounds.ll.y = bounds.ur.y = y;
+        maxBitSize = bitsize;
+        maxBitSizeDirty = false;
+        totalBitSize = bitsize;
     } else {
-        if (inst.getX() < bounds.ll.x) bounds.ll.x = inst.getX();
-        if (inst.getX() > bounds.ur.x) bounds.ur.x = inst.getX();
-        if (inst.getY() < bounds.ll.y) bounds.ll.y = inst.getY();
-        if (inst.getY() > bounds.ur.y) bounds.ur.y = inst.getY();
-        if (inst.getBitsize() > maxBitSize) maxBitSize = inst.getBitsize();
-        totalBitSize += inst.getBitsize();
-    }
-    auto cell = getCell(Point2D(inst.getX(), inst.getY()));
-    grid[cell].push_back(inst);
+        growBounds(x, y);
+        // Not below the bound, so exact again
+        if (bitsize >= maxBitSize) {
+            maxBitSize = bitsize;
+            maxBitSizeDirty = false;
+        }
+        totalBitSize += bitsize;
+    }
     instanceCount += 1;
+    ++revision;
+
+    std::uint32_t bin;
+    if (!indexDirty && getIndexedBin(getCell(Point2D(x, y)), bin)) {
+        pendingChanges.emplace_back(id, noBin);
+    } else {
+        indexDirty = true;
+    }
+    return id;
 }
 
-// Get all instances in the cell containing (x, y)
-const std::vector<Instance>& InstanceGrid::getCellInstances(float x, float y) const {
-    static const std::vector<Instance> empty;
-    auto it = grid.find(getCell(Point2D(x, y)));
-    if (it != grid.end()) return it->second;
-    return empty;
+void InstanceGrid::growBounds(float x, float y) {
+    if (x < bounds.ll.x) bounds.ll.x = x;
+    if (x > bounds.ur.x) bounds.ur.x = x;
+    if (y < bounds.ll.y) bounds.ll.y = y;
+    if (y > bounds.ur.y) bounds.ur.y = y;
 }
 
-// Get all instances within the bounding box
-std::vector<Instance> InstanceGrid::getCellInstancesWithin(const BoundingBox& bbox) const {
-    std::vector<Instance> result;
-    int cellMinX = static_cast<int>(std::floor(bbox.ll.x / binSize));
-    int cellMaxX = static_cast<int>(std::floor(bbox.ur.x / binSize));
-    int cellMinY = static_cast<int>(std::floor(bbox.ll.y / binSize));
-    int cellMaxY = static_cast<int>(std::floor(bbox.ur.y / binSize));
-
-    for (int cx = cellMinX; cx <= cellMaxX; ++cx) {
-        for (int cy = cellMinY; cy <= cellMaxY; ++cy) {
-            auto it = grid.find({cx, cy});
-            if (it != grid.end()) {
-                for (const auto& inst : it->second) {
-                    if (inst.getX() >= bbox.ll.x && inst.getX() <= bbox.ur.x &&
-                        inst.getY() >= bbox.ll.y && inst.getY() <= bbox.ur.y) {
-                        result.push_back(inst);
-                    }
-                }
-            }
+bool InstanceGrid::getIndexedBin(const std::pair<int, int>& cell, std::uint32_t& bin) const {
+    if (nx == 0 || cell.first < minCx || cell.first >= minCx + nx || cell.second < minCy || cell.second >= minCy + ny) {
+        return false;
+    }
+    bin = std::uint32_t(cell.second - minCy) + std::uint32_t(cell.first - minCx) * std::uint32_t(ny);
+    return true;
+}
+
+void InstanceGrid::moveInstance(InstanceId id, float x, float y) {
+    if (base) return base->moveInstance(id, x, y);
+    if (isRemoved(id)) return;
+    ++revision;
+    std::uint32_t oldBin = noBin;
+    bool indexed = !indexDirty && getIndexedBin(getCell(instances.getLocation(id)), oldBin);
+    instances.setLocation(id, x, y);
+    growBounds(x, y);
+
+    std::uint32_t newBin;
+    if (indexed && getIndexedBin(getCell(Point2D(x, y)), newBin)) {
+        pendingChanges.emplace_back(id, oldBin);
+    } else {
+        indexDirty = true;
+    }
+}
+
+void InstanceGrid::removeInstance(InstanceId id) {
+    if (base) return base->removeInstance(id);
+    if (isRemoved(id)) return;
+    ++revision;
+    if (removed.size() < instances.size()) removed.resize(instances.size(), 0);
+    std::uint32_t oldBin = noBin;
+    if (!indexDirty && getIndexedBin(getCell(instances.getLocation(id)), oldBin)) {
+        pendingChanges.emplace_back(id, oldBin);
+    } else {
+        indexDirty = true;
+    }
+    removed[id] = 1;
+    instanceCount -= 1;
+    totalBitSize -= instances.getBitsize(id);
+    if (instances.getBitsize(id) == maxBitSize) maxBitSizeDirty = true;
+}
+
+// Counting sort of all instances by bin
+void InstanceGrid::buildIndex() const {
+    if (base) {
+        base->buildIndex();
+        if (indexDirty || indexedRevision != base->revision) aggregateIndex();
+        return;
+    }
+    if (!indexDirty) {
+        if (!pendingChanges.empty()) patchIndex();
+        return;
+    }
+    indexDirty = false;
+    pendingChanges.clear();
+
+    size_t count = instances.size();
+    if (instanceCount == 0) {
+        minCx = minCy = nx = ny = 0;
+        binInstances.clear();
+        binOffsets.assign(1, 0);
+        return;
+    }
+
+    auto first = getCell(bounds.ll);
+    auto last = getCell(bounds.ur);
+    minCx = first.first;
+    minCy = first.second;
+    nx = last.first - first.first + 1;
+    ny = last.second - first.second + 1;
+
+    std::vector<std::uint32_t> binOf(count);
+    binOffsets.assign(size_t(nx) * ny + 1, 0);
+    for (InstanceId id = 0; id < count; ++id) {
+        if (isRemoved(id)) continue;
+        auto cell = getCell(instances.getLocation(id));
+        std::uint32_t bin = std::uint32_t(cell.second - minCy) + std::uint32_t(cell.first - minCx) * std::uint32_t(ny);
+        binOf[id] = bin;
+        ++binOffsets[bin + 1];
+    }
+    for (size_t i = 1; i < binOffsets.size(); ++i) {
+        binOffsets[i] += binOffsets[i - 1];
+    }
+
+    // Stable scatter keeps insertion order inside each bin
+    binInstances.resize(instanceCount);
+    std::vector<std::uint32_t> cursor(binOffsets.begin(), binOffsets.end() - 1);
+    for (InstanceId id = 0; id < count; ++id) {
+        if (isRemoved(id)) continue;
+        binInstances[cursor[binOf[id]]++] = id;
+    }
+}
+
+// A level bin is the union of factor x factor base bins, each column of them
+// one slice of the base index. The slices are concatenated and sorted by id,
+// the order a grid loaded at the level bin size has.
+void InstanceGrid::aggregateIndex() const {
+    indexDirty = false;
+    indexedRevision = base->revision;
+    if (base->instanceCount == 0) {
+        minCx = minCy = nx = ny = 0;
+        binInstances.clear();
+        binOffsets.assign(1, 0);
+        return;
+    }
+
+    int baseMaxCx = base->minCx + base->nx - 1;
+    int baseMaxCy = base->minCy + base->ny - 1;
+    minCx = floorDiv(base->minCx, factor);
+    minCy = floorDiv(base->minCy, factor);
+    nx = floorDiv(baseMaxCx, factor) - minCx + 1;
+    ny = floorDiv(baseMaxCy, factor) - minCy + 1;
+
+    // Calls fn(first, last) with the base index slice of every base column in bin (cx, cy)
+    auto forEachSlice = [&](int cx, int cy, auto&& fn) {
+        int fromY = std::max(cy * factor, base->minCy) - base->minCy;
+        int toY = std::min(cy * factor + factor - 1, baseMaxCy) - base->minCy;
+        int lastX = std::min(cx * factor + factor - 1, baseMaxCx);
+        for (int bx = std::max(cx * factor, base->minCx); bx <= lastX; ++bx) {
+            size_t column = size_t(bx - base->minCx) * base->ny;
+            fn(base->binOffsets[column + fromY], base->binOffsets[column + toY + 1]);
+        }
+    };
+
+    binOffsets.assign(size_t(nx) * ny + 1, 0);
+    for (int ix = 0; ix < nx; ++ix) {
+        for (int iy = 0; iy < ny; ++iy) {
+            std::uint32_t& count = binOffsets[size_t(ix) * ny + iy + 1];
+            forEachSlice(minCx + ix, minCy + iy, [&](std::uint32_t first, std::uint32_t last) { count += last - first; });
+        }
+    }
+    for (size_t i = 1; i < binOffsets.size(); ++i) {
+        binOffsets[i] += binOffsets[i - 1];
+    }
+
+    binInstances.resize(base->binInstances.size());
+    for (int ix = 0; ix < nx; ++ix) {
+        for (int iy = 0; iy < ny; ++iy) {
+            size_t bin = size_t(ix) * ny + iy;
+            auto first = binInstances.begin() + binOffsets[bin];
+            auto out = first;
+            forEachSlice(minCx + ix, minCy + iy, [&](std::uint32_t from, std::uint32_t to) {
+                out = std::copy(base->binInstances.begin() + from, base->binInstances.begin() + to, out);
+            });
+            if (!std::is_sorted(first, out)) std::sort(first, out);
         }
     }
-    return result;
 }
 
-// Reads instances from a file and adds them to the grid
-void InstanceGrid::readInstancesFromFile(const std::string& filename) {
-    std::ifstream infile(filename);
-    std::string line;
-    while (std::getline(infile, line)) {
-        std::istringstream iss(line);
-        std::string name;
-        float x, y;
-        unsigned int bitsize;
-        if (iss >> name >> x >> y >> bitsize) {
-            Instance inst(name, x, y, bitsize);
-            addInstance(inst);
+// Applies pendingChanges to the index in one sequential pass. Untouched bins
+// are copied as whole runs, touched bins are merged by id, so the result is
+// the same as a rebuild.
+void InstanceGrid::patchIndex() const {
+    // A large batch is cheaper to rebuild
+    if (pendingChanges.size() > instanceCount / 8) {
+        indexDirty = true;
+        buildIndex();
+        return;
+    }
+
+    // The first change of an instance holds the bin it is indexed in
+    std::stable_sort(pendingChanges.begin(), pendingChanges.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    pendingChanges.erase(std::unique(pendingChanges.begin(), pendingChanges.end(),
+                                     [](const auto& a, const auto& b) { return a.first == b.first; }),
+                         pendingChanges.end());
+
+    // (bin, id) pairs leaving and entering bins
+    std::vector<std::pair<std::uint32_t, InstanceId>> leaving, entering;
+    for (const auto& change : pendingChanges) {
+        InstanceId id = change.first;
+        if (change.second != noBin) leaving.emplace_back(change.second, id);
+        std::uint32_t bin;
+        if (!isRemoved(id) && getIndexedBin(getCell(instances.getLocation(id)), bin)) entering.emplace_back(bin, id);
+    }
+    pendingChanges.clear();
+    std::sort(leaving.begin(), leaving.end());
+    std::sort(entering.begin(), entering.end());
+
+    std::vector<std::uint32_t> touched;
+    for (const auto& entry : leaving) touched.push_back(entry.first);
+    for (const auto& entry : entering) touched.push_back(entry.first);
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+    std::vector<InstanceId> patched;
+    patched.reserve(instanceCount);
+    std::vector<std::uint32_t> newOffsets(binOffsets.size());
+    auto leave = leaving.begin();
+    auto enter = entering.begin();
+    std::uint32_t copiedBins = 0;
+    for (std::uint32_t bin : touched) {
+        // Untouched bins before this one move as one run, their offsets shift
+        std::int64_t shift = std::int64_t(patched.size()) - binOffsets[copiedBins];
+        patched.insert(patched.end(), binInstances.begin() + binOffsets[copiedBins], binInstances.begin() + binOffsets[bin]);
+        for (std::uint32_t b = copiedBins; b < bin; ++b) newOffsets[b] = std::uint32_t(binOffsets[b] + shift);
+        newOffsets[bin] = std::uint32_t(patched.size());
+
+        // Merge the bin without its leaving ids with its entering ids, both by id
+        auto leaveEnd = leave;
+        while (leaveEnd != leaving.end() && leaveEnd->first == bin) ++leaveEnd;
+        for (std::uint32_t i = binOffsets[bin]; i < binOffsets[bin + 1]; ++i) {
+            InstanceId id = binInstances[i];
+            bool left = std::binary_search(leave, leaveEnd, std::make_pair(bin, id));
+            for (; enter != entering.end() && enter->first == bin && enter->second < id; ++enter) {
+                patched.push_back(enter->second);
+            }
+            if (!left) patched.push_back(id);
         }
+        for (; enter != entering.end() && enter->first == bin; ++enter) patched.push_back(enter->second);
+        leave = leaveEnd;
+        copiedBins = bin + 1;
     }
+    std::uint32_t binCount = std::uint32_t(binOffsets.size() - 1);
+    std::int64_t shift = std::int64_t(patched.size()) - binOffsets[copiedBins];
+    patched.insert(patched.end(), binInstances.begin() + binOffsets[copiedBins], binInstances.end());
+    for (std::uint32_t b = copiedBins; b <= binCount; ++b) newOffsets[b] = std::uint32_t(binOffsets[b] + shift);
+
+    binInstances.swap(patched);
+    binOffsets.swap(newOffsets);
+}
+
+// Get all instances in the cell containing (x, y)
+InstanceRange InstanceGrid::getCellInstances(float x, float y) const {
+    auto cell = getCell(Point2D(x, y));
+    return getBinInstances(cell.first, cell.second);
+}
+
+// Get all instances in bin (cx, cy)
+InstanceRange InstanceGrid::getBinInstances(int cx, int cy) const {
+    buildIndex();
+    if (cx < minCx || cx >= minCx + nx || cy < minCy || cy >= minCy + ny) return InstanceRange();
+    size_t bin = size_t(cy - minCy) + size_t(cx - minCx) * ny;
+    return InstanceRange{binInstances.data() + binOffsets[bin], binInstances.data() + binOffsets[bin + 1]};
+}
+
+// Get all instances within the bounding box
+std::vector<InstanceId> InstanceGrid::getCellInstancesWithin(const BoundingBox& bbox) const {
+    std::vector<InstanceId> result;
+    forEachRangeWithin(bbox, [&result](InstanceRange range) {
+        result.insert(result.end(), range.begin(), range.end());
+    });
+    return result;
 }
 
 // Generates a file with random instances within a bounding box
 void InstanceGrid::generateRandomInstancesToFile(const std::string& filename, size_t count,
-                                                 const BoundingBox& searchBox, size_t nameLength) {
+                                                 const BoundingBox& searchBox, size_t nameLength,
+                                                 std::uint32_t seed) {
     std::ofstream out(filename);
     if (!out) return;
 
-    std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::mt19937 rng(seed ? seed : std::chrono::steady_clock::now().time_since_epoch().count());
     std::uniform_real_distribution<float> distX(searchBox.ll.x, searchBox.ur.x);
     std::uniform_real_distribution<float> distY(searchBox.ll.y, searchBox.ur.y);
     std::uniform_int_distribution<int> distBitsize(0, 8);
@@ -109,11 +360,11 @@ void InstanceGrid::generateRandomInstancesToFile(const std::string& filename, si
 // Generates a file with instances distributed in Gaussian clusters
 void InstanceGrid::generateGaussianClustersToFile(const std::string& filename, size_t instanceCount,
                                                  size_t clusterCount, const BoundingBox& area,
-                                                 float stddev, size_t nameLength) {
+                                                 float stddev, size_t nameLength, std::uint32_t seed) {
     std::ofstream out(filename);
     if (!out) return;
 
-    std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::mt19937 rng(seed ? seed : std::chrono::steady_clock::now().time_since_epoch().count());
     std::uniform_real_distribution<float> distX(area.ll.x, area.ur.x);
     std::uniform_real_distribution<float> distY(area.ll.y, area.ur.y);
     std::uniform_int_distribution<int> distBitsize(0, 8);
@@ -154,32 +405,81 @@ void InstanceGrid::generateGaussianClustersToFile(const std::string& filename, s
 
 // Returns the cell coordinates for a given Point2D
 std::pair<int, int> InstanceGrid::getCell(const Point2D& p) const {
+    if (base) {
+        auto cell = base->getCell(p);
+        return {floorDiv(cell.first, factor), floorDiv(cell.second, factor)};
+    }
     int cellX = static_cast<int>(std::floor(p.x / binSize));
     int cellY = static_cast<int>(std::floor(p.y / binSize));
     return {cellX, cellY};
 }
 
-// Accessors for grid, bounds, and binSize
-std::unordered_map<std::pair<int, int>, std::vector<Instance>, PairHash>& InstanceGrid::getGrid() {
-    return grid;
+// Accessors for the bin index, bounds, and binSize
+const InstanceTable& InstanceGrid::getInstances() const {
+    return base ? base->instances : instances;
+}
+
+InstanceRange InstanceGrid::getBinnedInstances() const {
+    buildIndex();
+    return InstanceRange{binInstances.data(), binInstances.data() + binInstances.size()};
+}
+
+std::pair<int, int> InstanceGrid::getFirstCell() const {
+    buildIndex();
+    return {minCx, minCy};
+}
+
+int InstanceGrid::getBinCountX() const {
+    buildIndex();
+    return nx;
+}
+
+int InstanceGrid::getBinCountY() const {
+    buildIndex();
+    return ny;
 }
 
 BoundingBox& InstanceGrid::getBounds() {
-    return bounds;
+    return base ? base->bounds : bounds;
 }
 
-float InstanceGrid::getBinSize() {
-    return binSize;
+const BoundingBox& InstanceGrid::getBounds() const {
+    return base ? base->bounds : bounds;
 }
 
-unsigned int InstanceGrid::getMaxBitSize() {
+void InstanceGrid::setBinSize(float size) {
+    if (base) {
+        factor = std::max(1, int(std::lround(size / base->binSize)));
+    } else {
+        binSize = size;
+        ++revision;
+    }
+    indexDirty = true;
+    pendingChanges.clear();
+}
+
+float InstanceGrid::getBinSize() const {
+    return base ? base->binSize * factor : binSize;
+}
+
+// Rescans the live instances once after the largest one was removed, so a
+// removed outlier does not keep shrinking the partition margins
+unsigned int InstanceGrid::getMaxBitSize() const {
+    if (base) return base->getMaxBitSize();
+    if (maxBitSizeDirty) {
+        maxBitSize = 0;
+        for (InstanceId id = 0; id < instances.size(); ++id) {
+            if (!isRemoved(id)) maxBitSize = std::max(maxBitSize, instances.getBitsize(id));
+        }
+        maxBitSizeDirty = false;
+    }
     return maxBitSize;
 }
 
-size_t InstanceGrid::getInstanceCount() {
-    return instanceCount;
+size_t InstanceGrid::getInstanceCount() const {
+    return base ? base->instanceCount : instanceCount;
 }
 
-size_t InstanceGrid::getTotalBitSize() {
-    return totalBitSize;
+size_t InstanceGrid::getTotalBitSize() const {
+    return base ? base->totalBitSize : totalBitSize;
 }
\ No newline at end of file
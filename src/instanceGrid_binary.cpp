@@ -0,0 +1,238 @@
+#include "instanceGrid.hpp"
+#include "instanceFile.hpp"
+#include "mappedFile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace {
+
+std::uint64_t alignTo8(std::uint64_t offset) {
+    return (offset + 7) & ~std::uint64_t(7);
+}
+
+bool blockFits(std::uint64_t offset, std::uint64_t bytes, size_t fileSize) {
+    return offset <= fileSize && bytes <= fileSize - offset;
+}
+
+// Checks magic, version and that every block lies inside the file
+bool validateHeader(const InstanceFileHeader& h, size_t fileSize) {
+    if (std::memcmp(h.magic, instanceFileMagic, sizeof(h.magic)) != 0) return false;
+    if (h.version != instanceFileVersion || h.byteOrder != instanceFileByteOrder) return false;
+    if (h.count > std::numeric_limits<InstanceId>::max()) return false;
+    if (h.nameCount > std::numeric_limits<std::uint32_t>::max()) return false;
+    return blockFits(h.xOffset, h.count * sizeof(float), fileSize) &&
+           blockFits(h.yOffset, h.count * sizeof(float), fileSize) &&
+           blockFits(h.bitsizeOffset, h.count * sizeof(std::uint32_t), fileSize) &&
+           blockFits(h.nameIndexOffset, h.count * sizeof(std::uint32_t), fileSize) &&
+           blockFits(h.nameHashOffset, h.nameCount * sizeof(std::uint32_t), fileSize) &&
+           blockFits(h.nameOffsetsOffset, (h.nameCount + 1) * sizeof(std::uint64_t), fileSize) &&
+           blockFits(h.namesOffset, h.nameBytes, fileSize);
+}
+
+// Replaces the bounds and totals of the header with those of the x, y and
+// bitsize columns, which the index and the band split rely on. False when a
+// coordinate is not finite.
+bool summarizeColumns(InstanceFileHeader& h, const char* data) {
+    const float* xs = reinterpret_cast<const float*>(data + h.xOffset);
+    const float* ys = reinterpret_cast<const float*>(data + h.yOffset);
+    const std::uint32_t* bitsizes = reinterpret_cast<const std::uint32_t*>(data + h.bitsizeOffset);
+    float minX = 0, minY = 0, maxX = 0, maxY = 0;
+    std::uint64_t totalBitSize = 0;
+    std::uint32_t maxBitSize = 0;
+    for (size_t i = 0; i < h.count; ++i) {
+        float x = xs[i], y = ys[i];
+        if (!std::isfinite(x) || !std::isfinite(y)) return false;
+        if (i == 0) {
+            minX = maxX = x;
+            minY = maxY = y;
+        } else {
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+        }
+        totalBitSize += bitsizes[i];
+        maxBitSize = std::max(maxBitSize, bitsizes[i]);
+    }
+    h.minX = minX;
+    h.minY = minY;
+    h.maxX = maxX;
+    h.maxY = maxY;
+    h.totalBitSize = totalBitSize;
+    h.maxBitSize = maxBitSize;
+    return true;
+}
+
+void writeBlock(std::ofstream& out, std::uint64_t offset, const void* data, size_t bytes) {
+    static const char zeros[8] = {};
+    std::uint64_t pos = static_cast<std::uint64_t>(out.tellp());
+    out.write(zeros, offset - pos);
+    out.write(static_cast<const char*>(data), bytes);
+}
+
+}
+
+InstanceFileHeader makeInstanceFileHeader(std::uint64_t count, std::uint64_t nameCount, std::uint64_t nameBytes) {
+    InstanceFileHeader h = {};
+    std::memcpy(h.magic, instanceFileMagic, sizeof(h.magic));
+    h.version = instanceFileVersion;
+    h.byteOrder = instanceFileByteOrder;
+    h.count = count;
+    h.nameCount = nameCount;
+    h.nameBytes = nameBytes;
+    h.xOffset = alignTo8(sizeof(h));
+    h.yOffset = alignTo8(h.xOffset + count * sizeof(float));
+    h.bitsizeOffset = alignTo8(h.yOffset + count * sizeof(float));
+    h.nameIndexOffset = alignTo8(h.bitsizeOffset + count * sizeof(std::uint32_t));
+    h.nameHashOffset = alignTo8(h.nameIndexOffset + count * sizeof(std::uint32_t));
+    h.nameOffsetsOffset = alignTo8(h.nameHashOffset + nameCount * sizeof(std::uint32_t));
+    h.namesOffset = alignTo8(h.nameOffsetsOffset + (nameCount + 1) * sizeof(std::uint64_t));
+    return h;
+}
+
+bool readInstanceFileHeader(const std::string& filename, InstanceFileHeader& header) {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    size_t fileSize = static_cast<size_t>(in.tellg());
+    if (fileSize < sizeof(header)) return false;
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    return in && validateHeader(header, fileSize);
+}
+
+bool readInstanceFileSummary(const std::string& filename, InstanceFileHeader& header) {
+    MappedFile file(filename);
+    if (!file.data || file.size < sizeof(header)) return false;
+    std::memcpy(&header, file.data, sizeof(header));
+    return validateHeader(header, file.size) && summarizeColumns(header, file.data);
+}
+
+bool convertInstanceTextToBinary(const std::string& textFile, const std::string& binaryFile) {
+    InstanceGrid grid(1.0f);
+    grid.readInstancesFromFile(textFile);
+    return grid.writeBinaryFile(binaryFile);
+}
+
+// Writes the instances in the binary format. Removed rows are left out, so
+// the columns match the header totals; names stay indexed into the full arena.
+bool InstanceGrid::writeBinaryFile(const std::string& filename) const {
+    if (base) return base->writeBinaryFile(filename);
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    const NameArena& arena = instances.getNames();
+    const float* xs = instances.getXs();
+    const float* ys = instances.getYs();
+    const unsigned int* bitsizes = instances.getBitsizes();
+    size_t count = instanceCount;
+
+    std::vector<std::uint32_t> nameIndex(count);
+    std::vector<float> keptXs, keptYs;
+    std::vector<unsigned int> keptBitsizes;
+    // The grid keeps its bounds and largest bitsize when instances are
+    // removed, the header describes the rows that are written
+    BoundingBox keptBounds = bounds;
+    unsigned int keptMaxBitSize = maxBitSize;
+    if (count != instances.size()) {
+        keptXs.reserve(count);
+        keptYs.reserve(count);
+        keptBitsizes.reserve(count);
+        keptMaxBitSize = 0;
+        for (InstanceId id = 0; id < instances.size(); ++id) {
+            if (isRemoved(id)) continue;
+            if (keptXs.empty()) keptBounds = BoundingBox(xs[id], ys[id], xs[id], ys[id]);
+            keptBounds.ll.x = std::min(keptBounds.ll.x, xs[id]);
+            keptBounds.ll.y = std::min(keptBounds.ll.y, ys[id]);
+            keptBounds.ur.x = std::max(keptBounds.ur.x, xs[id]);
+            keptBounds.ur.y = std::max(keptBounds.ur.y, ys[id]);
+            keptMaxBitSize = std::max(keptMaxBitSize, bitsizes[id]);
+            nameIndex[keptXs.size()] = instances.getNameHandle(id).index;
+            keptXs.push_back(xs[id]);
+            keptYs.push_back(ys[id]);
+            keptBitsizes.push_back(bitsizes[id]);
+        }
+        xs = keptXs.data();
+        ys = keptYs.data();
+        bitsizes = keptBitsizes.data();
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            nameIndex[i] = instances.getNameHandles()[i].index;
+        }
+    }
+
+    InstanceFileHeader h = makeInstanceFileHeader(count, arena.size(), arena.getByteSize());
+    h.totalBitSize = totalBitSize;
+    h.maxBitSize = keptMaxBitSize;
+    h.minX = keptBounds.ll.x;
+    h.minY = keptBounds.ll.y;
+    h.maxX = keptBounds.ur.x;
+    h.maxY = keptBounds.ur.y;
+
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    writeBlock(out, h.xOffset, xs, count * sizeof(float));
+    writeBlock(out, h.yOffset, ys, count * sizeof(float));
+    writeBlock(out, h.bitsizeOffset, bitsizes, count * sizeof(std::uint32_t));
+    writeBlock(out, h.nameIndexOffset, nameIndex.data(), count * sizeof(std::uint32_t));
+    writeBlock(out, h.nameHashOffset, arena.getHashes().data(), h.nameCount * sizeof(std::uint32_t));
+    writeBlock(out, h.nameOffsetsOffset, arena.getOffsets().data(), (h.nameCount + 1) * sizeof(std::uint64_t));
+    writeBlock(out, h.namesOffset, arena.getBuffer().data(), h.nameBytes);
+    return static_cast<bool>(out);
+}
+
+// Loads a binary instance file. Into an empty grid the columns and the name
+// arena are copied straight from the mapping, with bounds and totals taken
+// from the columns rather than the header; otherwise the instances are
+// appended one by one. Files with coordinates that are not finite are rejected.
+bool InstanceGrid::readBinaryFile(const std::string& filename) {
+    if (base) return base->readBinaryFile(filename);
+    MappedFile file(filename);
+    if (!file.data || file.size < sizeof(InstanceFileHeader)) return false;
+
+    InstanceFileHeader h;
+    std::memcpy(&h, file.data, sizeof(h));
+    if (!validateHeader(h, file.size)) return false;
+
+    const float* xs = reinterpret_cast<const float*>(file.data + h.xOffset);
+    const float* ys = reinterpret_cast<const float*>(file.data + h.yOffset);
+    const unsigned int* bitsizes = reinterpret_cast<const unsigned int*>(file.data + h.bitsizeOffset);
+    const std::uint32_t* nameIndex = reinterpret_cast<const std::uint32_t*>(file.data + h.nameIndexOffset);
+    const std::uint32_t* nameHashes = reinterpret_cast<const std::uint32_t*>(file.data + h.nameHashOffset);
+    const std::uint64_t* nameOffsets = reinterpret_cast<const std::uint64_t*>(file.data + h.nameOffsetsOffset);
+    std::string_view names(file.data + h.namesOffset, h.nameBytes);
+
+    for (size_t i = 0; i < h.count; ++i) {
+        if (nameIndex[i] >= h.nameCount) return false;
+    }
+    if (!summarizeColumns(h, file.data)) return false;
+    if (nameOffsets[0] != 0 || nameOffsets[h.nameCount] != h.nameBytes) return false;
+    for (size_t i = 0; i < h.nameCount; ++i) {
+        if (nameOffsets[i] > nameOffsets[i + 1]) return false;
+    }
+
+    if (instanceCount == 0) {
+        instances.clear();
+        removed.clear();
+        instances.getNames().assign(names, nameOffsets, nameHashes, h.nameCount);
+        instances.assign(xs, ys, bitsizes, nameIndex, h.count);
+        instanceCount = h.count;
+        totalBitSize = h.totalBitSize;
+        maxBitSize = h.maxBitSize;
+        maxBitSizeDirty = false;
+        bounds = BoundingBox(h.minX, h.minY, h.maxX, h.maxY);
+        indexDirty = true;
+        ++revision;
+    } else {
+        instances.reserve(instances.size() + h.count, instances.getNames().getByteSize() + h.nameBytes);
+        for (size_t i = 0; i < h.count; ++i) {
+            std::uint32_t n = nameIndex[i];
+            std::string_view name = names.substr(nameOffsets[n], nameOffsets[n + 1] - nameOffsets[n]);
+            NameHandle handle = instances.getNames().intern(name, nameHashes[n]);
+            placeInstance(instances.add(handle, xs[i], ys[i], bitsizes[i]));
+        }
+    }
+    buildIndex();
+    return true;
+}
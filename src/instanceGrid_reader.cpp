@@ -0,0 +1,80 @@
+#include "instanceGrid.hpp"
+#include "instanceFile.hpp"
+#include "mappedFile.hpp"
+#include "parallel.hpp"
+#include <cstring>
+
+namespace {
+
+// Instances parsed by one thread; names point into the mapped file
+struct ParsedChunk {
+    std::vector<std::string_view> names;
+    std::vector<std::uint32_t> hashes;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<unsigned int> bitsize;
+    size_t nameBytes = 0;
+};
+
+// Instances in [p, end), malformed lines are skipped
+void parseChunk(const char* p, const char* end, ParsedChunk& out) {
+    while (p != end) {
+        std::string_view name;
+        float x, y;
+        unsigned int bitsize;
+        bool ok;
+        p = parseInstanceLine(p, end, name, x, y, bitsize, ok);
+        if (ok) {
+            out.names.push_back(name);
+            out.hashes.push_back(NameArena::hashName(name));
+            out.x.push_back(x);
+            out.y.push_back(y);
+            out.bitsize.push_back(bitsize);
+            out.nameBytes += name.size();
+        }
+    }
+}
+
+}
+
+// Reads instances from a file and adds them to the grid. The file is
+// memory mapped and split into newline aligned chunks parsed in parallel,
+// the results are appended in file order.
+void InstanceGrid::readInstancesFromFile(const std::string& filename) {
+    if (base) return base->readInstancesFromFile(filename);
+    MappedFile file(filename);
+    if (!file.data) return;
+
+    // Keep chunks at a few MB so small files stay single threaded
+    constexpr size_t minChunkBytes = 4 << 20;
+    size_t chunkCount = std::max<size_t>(1, std::min(getDefaultThreadCount(), file.size / minChunkBytes));
+
+    std::vector<const char*> bounds(chunkCount + 1);
+    bounds[0] = file.data;
+    bounds[chunkCount] = file.data + file.size;
+    for (size_t i = 1; i < chunkCount; ++i) {
+        const char* p = std::max(bounds[i - 1], file.data + file.size * i / chunkCount);
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', bounds[chunkCount] - p));
+        bounds[i] = eol ? eol + 1 : bounds[chunkCount];
+    }
+
+    std::vector<ParsedChunk> chunks(chunkCount);
+    parallelFor(chunkCount, chunkCount, [&](size_t i) {
+        parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+    });
+
+    // Bulk append in file order
+    size_t count = 0, nameBytes = 0;
+    for (const auto& chunk : chunks) {
+        count += chunk.x.size();
+        nameBytes += chunk.nameBytes;
+    }
+    instances.reserve(instances.size() + count, instances.getNames().getByteSize() + nameBytes);
+    for (const auto& chunk : chunks) {
+        for (size_t i = 0; i < chunk.x.size(); ++i) {
+            NameHandle name = instances.getNames().intern(chunk.names[i], chunk.hashes[i]);
+            placeInstance(instances.add(name, chunk.x[i], chunk.y[i], chunk.bitsize[i]));
+        }
+    }
+    buildIndex();
+}
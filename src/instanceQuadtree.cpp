@@ -0,0 +1,91 @@
+#include "instanceQuadtree.hpp"
+#include <algorithm>
+
+namespace {
+
+// Hilbert curve states: the quadrants (x + 2 * y) in visiting order and the
+// state of each of them
+constexpr int curveOrder[4][4] = {{0, 2, 3, 1}, {0, 1, 3, 2}, {3, 1, 0, 2}, {3, 2, 0, 1}};
+constexpr int curveNext[4][4] = {{1, 0, 0, 3}, {0, 1, 1, 2}, {3, 2, 2, 1}, {2, 3, 3, 0}};
+
+}
+
+InstanceQuadtree::InstanceQuadtree(const InstanceGrid& grid, unsigned int targetBitSize)
+    : table(&grid.getInstances()), targetBitSize(std::max(1u, targetBitSize)) {
+    std::vector<Record> records;
+    records.reserve(grid.getInstanceCount());
+    for (InstanceId id = 0; id < table->size(); ++id) {
+        if (!grid.isRemoved(id)) records.push_back({table->getX(id), table->getY(id), table->getBitsize(id), id});
+    }
+    if (records.empty()) return;
+    std::vector<Record> scratch(records.size());
+    ids.resize(records.size());
+    build(records, scratch, 0, static_cast<std::uint32_t>(records.size()), grid.getTotalBitSize(), grid.getBounds(), 0, 0);
+}
+
+// The slice is in records, the children are sorted into scratch and swap the roles
+std::uint32_t InstanceQuadtree::build(std::vector<Record>& records, std::vector<Record>& scratch,
+                                      std::uint32_t first, std::uint32_t last, std::uint64_t bitsize,
+                                      const BoundingBox& box, int depth, int state) {
+    std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+    nodes[index].box = box;
+    nodes[index].first = first;
+    nodes[index].last = last;
+    nodes[index].firstLeaf = static_cast<std::uint32_t>(leaves.size());
+
+    auto begin = records.begin();
+    if (bitsize <= targetBitSize || last - first <= 1 || depth >= maxDepth) {
+        std::sort(begin + first, begin + last, [](const Record& a, const Record& b) {
+            if (a.x != b.x) return a.x < b.x;
+            return a.y < b.y || (a.y == b.y && a.id < b.id);
+        });
+        for (std::uint32_t i = first; i < last; ++i) ids[i] = records[i].id;
+        Leaf leaf;
+        leaf.box = box;
+        leaf.first = first;
+        leaf.last = last;
+        leaf.bitsize = bitsize;
+        leaves.push_back(leaf);
+        nodes[index].isLeaf = true;
+        nodes[index].lastLeaf = static_cast<std::uint32_t>(leaves.size());
+        return index;
+    }
+
+    // Instances on a split line go to the upper or right quadrant
+    float midX = (box.ll.x + box.ur.x) / 2;
+    float midY = (box.ll.y + box.ur.y) / 2;
+    auto quadrantOf = [&](const Record& r) { return int(r.x >= midX) + 2 * int(r.y >= midY); };
+    BoundingBox quadrants[4] = {
+        BoundingBox(box.ll.x, box.ll.y, midX, midY), BoundingBox(midX, box.ll.y, box.ur.x, midY),
+        BoundingBox(box.ll.x, midY, midX, box.ur.y), BoundingBox(midX, midY, box.ur.x, box.ur.y)};
+
+    // Counting sort of the slice into the quadrants in curve order, so each
+    // child stays contiguous
+    std::uint32_t counts[4] = {0, 0, 0, 0};
+    std::uint64_t sums[4] = {0, 0, 0, 0};
+    for (auto it = begin + first; it != begin + last; ++it) {
+        int quadrant = quadrantOf(*it);
+        ++counts[quadrant];
+        sums[quadrant] += it->bitsize;
+    }
+    std::uint32_t childFirst[5];
+    std::uint32_t cursor[4];
+    childFirst[0] = first;
+    for (int k = 0; k < 4; ++k) {
+        int quadrant = curveOrder[state][k];
+        cursor[quadrant] = childFirst[k];
+        childFirst[k + 1] = childFirst[k] + counts[quadrant];
+    }
+    for (auto it = begin + first; it != begin + last; ++it) scratch[cursor[quadrantOf(*it)]++] = *it;
+
+    for (int k = 0; k < 4; ++k) {
+        if (childFirst[k] == childFirst[k + 1]) continue;
+        int quadrant = curveOrder[state][k];
+        std::uint32_t child = build(scratch, records, childFirst[k], childFirst[k + 1], sums[quadrant],
+                                    quadrants[quadrant], depth + 1, curveNext[state][k]);
+        nodes[index].children[k] = child;
+    }
+    nodes[index].lastLeaf = static_cast<std::uint32_t>(leaves.size());
+    return index;
+}
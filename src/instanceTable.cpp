@@ -0,0 +1,43 @@
+#include "instanceTable.hpp"
+
+// Interns the name and appends an instance, returns its id
+InstanceId InstanceTable::add(std::string_view name, float x, float y, unsigned int bitsize) {
+    return add(arena.intern(name), x, y, bitsize);
+}
+
+// Appends an instance whose name is already interned in this table's arena
+InstanceId InstanceTable::add(NameHandle name, float x, float y, unsigned int bitsize) {
+    InstanceId id = static_cast<InstanceId>(this->x.size());
+    this->x.push_back(x);
+    this->y.push_back(y);
+    this->bitsize.push_back(bitsize);
+    names.push_back(name);
+    return id;
+}
+
+void InstanceTable::reserve(size_t count, size_t nameBytes) {
+    x.reserve(count);
+    y.reserve(count);
+    bitsize.reserve(count);
+    names.reserve(count);
+    arena.reserve(count, nameBytes);
+}
+
+void InstanceTable::assign(const float* xs, const float* ys, const unsigned int* bitsizes,
+                           const std::uint32_t* nameIndex, size_t count) {
+    x.assign(xs, xs + count);
+    y.assign(ys, ys + count);
+    bitsize.assign(bitsizes, bitsizes + count);
+    names.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        names[i] = arena.getHandle(nameIndex[i]);
+    }
+}
+
+void InstanceTable::clear() {
+    x.clear();
+    y.clear();
+    bitsize.clear();
+    names.clear();
+    arena.clear();
+}
@@ -4,6 +4,9 @@
 #include <QtWidgets>
 #include <instance.hpp>
 #include <instanceGrid.hpp>
+#include <instanceFile.hpp>
+#include <gridPyramid.hpp>
+#include "parallel.hpp"
 #include "partitioner.hpp"
 #include "viewer.hpp"
 
@@ -25,22 +28,29 @@ int main(int argc, char** argv) {
 
     QApplication app(argc, argv);
 
-    // Prepare grids
-    InstanceGrid coarseGrid(10.0);
-    InstanceGrid middleGrid(2.0);
-    InstanceGrid fineGrid(1.0);
+    // Prepare grids, the coarser ones share the instances of the fine one
+    GridPyramid pyramid(1.0, {2, 10});
+    InstanceGrid& fineGrid = pyramid.getLevel(0);
+    InstanceGrid& middleGrid = pyramid.getLevel(1);
+    InstanceGrid& coarseGrid = pyramid.getLevel(2);
+    InstanceGrid autoGrid(1.0);
+    // Partitioners, the grid tuning and the viewers share one thread count
+    size_t threadCount = getDefaultThreadCount();
 
-            std::cout << "| Algorithm | Grid    | Instances | Runtime (ms) | Route Len |\n";
-            std::cout << "|-----------|---------|-----------|--------------|-----------|\n";
+            std::cout << "| Algorithm | Grid    | Instances | Runtime (ms) | Route Len | MST Len | HPWL |\n";
+            std::cout << "|-----------|---------|-----------|--------------|-----------|---------|------|\n";
 
     for (size_t instCount = 10000; instCount < 50000; instCount *= 2) {
         instCount = 100000;
         // Generate and load instances
         std::string filename = "outfile" + std::to_string(instCount) + ".txt";
+        std::string binaryFilename = "outfile" + std::to_string(instCount) + ".bin";
         coarseGrid.generateGaussianClustersToFile(filename, instCount, 10, BoundingBox(Point2D(0.0f, 0.0f), Point2D(100.0f, 200.0f)), 10.0f, 8);
-        coarseGrid.readInstancesFromFile(filename);
-        fineGrid.readInstancesFromFile(filename);
-        middleGrid.readInstancesFromFile(filename);
+        // Parse the text once, the pyramid and the tuned grid load the binary snapshot
+        convertInstanceTextToBinary(filename, binaryFilename);
+        fineGrid.readBinaryFile(binaryFilename);
+        autoGrid.readBinaryFile(binaryFilename);
+        autoGrid.setBinSize(Partitioner::tuneLocalizedBinSize(autoGrid, 1000, 0, false, threadCount).binSize);
 
         //std::cout << "INSTANCES: " << fineGrid.getInstanceCount() << " BITS: " << fineGrid.getTotalBitSize() << std::endl;
         
@@ -48,12 +58,17 @@ int main(int argc, char** argv) {
         // Only run these combinations:
         std::vector<RunConfig> runs = {
             //{"COARSE", &coarseGrid, {"HASHMAP ",    &Partitioner::partitionHashmap}},
-            //{"MIDDLE", &middleGrid, {"HASHMAP ",    &Partitioner::partitionHashmap}},
+            {"MIDDLE", &middleGrid, {"HASHMAP ",    &Partitioner::partitionHashmap}},
             {"FINE  ", &fineGrid,   {"HASHMAP ",    &Partitioner::partitionHashmap}},
             {"FINE  ", &fineGrid,   {"LOCALIZE",    &Partitioner::partitionLocalized}},
-            //{"MIDDLE", &middleGrid, {"LOCALIZE",    &Partitioner::partitionLocalized}},
+            {"MIDDLE", &middleGrid, {"LOCALIZE",    &Partitioner::partitionLocalized}},
+            {" N/A  ", &fineGrid,   {"HILBERT ",    &Partitioner::partitionHilbert}},
+            {" N/A  ", &fineGrid,   {"BISECT  ",    &Partitioner::partitionBisection}},
             {"COARSE", &coarseGrid, {"LOCALIZE",    &Partitioner::partitionLocalized}},
+            {"AUTO  ", &autoGrid,   {"LOCALIZE",    &Partitioner::partitionLocalized}},
             {" N/A  ", &coarseGrid, {"MERGING ",    &Partitioner::partitionMerging}},
+            {"ADAPT ", &coarseGrid, {"QUADTREE",    &Partitioner::partitionQuadtree}},
+            {" N/A  ", &fineGrid,   {"MULTILVL",    &Partitioner::partitionMultilevel}},
             {" N/A  ", &coarseGrid, {"NEARBY  ",    &Partitioner::partitionNearby}}
         };
 
@@ -63,6 +78,7 @@ int main(int argc, char** argv) {
 
         for (const auto& run : runs) {
             auto partitioner = new Partitioner(*run.grid, 1000);
+            partitioner->setThreadCount(threadCount);
             partitioners.push_back(partitioner);
 
             auto t1 = high_resolution_clock::now();
@@ -70,7 +86,9 @@ int main(int argc, char** argv) {
             auto t2 = high_resolution_clock::now();
             duration<double, std::milli> ms_double = t2 - t1;
 
-            auto partitions = partitioner->getPartitions();
+            // The widget keeps a reference, partitioners live until exit
+            const auto& partitions = partitioner->getPartitions();
+            RoutingMetrics routing = partitioner->getRoutingMetrics();
             // Print the table header once (before the loop)
             // Inside your loop, print each row:
             std::cout << "| "
@@ -78,17 +96,22 @@ int main(int argc, char** argv) {
                     << run.gridType << " | "
                     << instCount << " | "
                     << ms_double.count() << " | "
-                    << partitioner->getPartitionsTotalRoutingLength() << " |\n";
+                    << routing.nearestNeighbour << " | "
+                    << routing.spanningTree << " | "
+                    << routing.halfPerimeter << " |\n";
             
-            /*
-            std::cout
-                    << " MISSED (DNF if non zero): " << partitioner->countGridInstancesMissedInPartitions() << std::endl
-                    << " UNBALANCED (DNF if non zero): " << partitioner->getViolatingBitLimitPartitionCount() << std::endl
-                    << " PARTITIONS: " << partitions.size() << std::endl
-                    << " AVERAGE: " << partitioner->getPartitionAverageBitSize() << std::endl
-                    ;
-            */
-            auto* widget = new DotWidget(*run.grid, partitions);
+            PartitionValidation validation = partitioner->validate();
+            if (!validation.isValid()) {
+                std::cout
+                        << " MISSED (DNF if non zero): " << validation.missedInstances << std::endl
+                        << " DUPLICATED (DNF if non zero): " << validation.duplicateInstances << std::endl
+                        << " REMOVED (DNF if non zero): " << validation.removedInstances << std::endl
+                        << " UNBALANCED (DNF if non zero): " << validation.overLimitPartitions.size() << std::endl
+                        << " PARTITIONS: " << partitions.size() << " (" << validation.emptyPartitions.size() << " empty)" << std::endl
+                        << " AVERAGE: " << partitioner->getPartitionAverageBitSize() << std::endl
+                        ;
+            }
+            auto* widget = new DotWidget(*run.grid, partitions, threadCount);
             width = int(ceil(std::min(float(width), run.grid->getBounds().ur.x * 4)));
             height = int(ceil(std::min(float(height), run.grid->getBounds().ur.y * 4)));
             widget->resize(width, height);
@@ -101,7 +124,7 @@ int main(int argc, char** argv) {
             widget->show();
             widgets.push_back(widget);
         }
-        std::cout << "| | | | | |\n";
+        std::cout << "| | | | | | | |\n";
     }
     // TODO: Properly delete partitioners and widgets if needed
     return app.exec();
@@ -0,0 +1,89 @@
+#include "nameArena.hpp"
+
+NameArena::NameArena() : offsets(1, 0), slots(16, 0) {}
+
+// FNV-1a, folded to 32 bits
+std::uint32_t NameArena::hashName(std::string_view name) {
+    std::uint64_t h = 1469598103934665603ull;
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return static_cast<std::uint32_t>(h ^ (h >> 32));
+}
+
+NameHandle NameArena::intern(std::string_view name) {
+    return intern(name, hashName(name));
+}
+
+NameHandle NameArena::intern(std::string_view name, std::uint32_t hash) {
+    // Keep the load factor below 1/2
+    if ((hashes.size() + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+
+    size_t mask = slots.size() - 1;
+    size_t slot = hash & mask;
+    while (slots[slot] != 0) {
+        std::uint32_t index = slots[slot] - 1;
+        if (hashes[index] == hash && getName(NameHandle{index, hash}) == name) {
+            return NameHandle{index, hash};
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    std::uint32_t index = static_cast<std::uint32_t>(hashes.size());
+    buffer.append(name.data(), name.size());
+    offsets.push_back(buffer.size());
+    hashes.push_back(hash);
+    slots[slot] = index + 1;
+    return NameHandle{index, hash};
+}
+
+std::optional<NameHandle> NameArena::find(std::string_view name) const {
+    std::uint32_t hash = hashName(name);
+    size_t mask = slots.size() - 1;
+    size_t slot = hash & mask;
+    while (slots[slot] != 0) {
+        std::uint32_t index = slots[slot] - 1;
+        if (hashes[index] == hash && getName(NameHandle{index, hash}) == name) {
+            return NameHandle{index, hash};
+        }
+        slot = (slot + 1) & mask;
+    }
+    return std::nullopt;
+}
+
+void NameArena::reserve(size_t count, size_t bytes) {
+    buffer.reserve(bytes);
+    offsets.reserve(count + 1);
+    hashes.reserve(count);
+    size_t slotCount = slots.size();
+    while (slotCount < count * 2) slotCount *= 2;
+    if (slotCount != slots.size()) rehash(slotCount);
+}
+
+void NameArena::clear() {
+    buffer.clear();
+    offsets.assign(1, 0);
+    hashes.clear();
+    slots.assign(16, 0);
+}
+
+void NameArena::assign(std::string_view names, const std::uint64_t* nameOffsets,
+                       const std::uint32_t* nameHashes, size_t count) {
+    buffer.assign(names.data(), names.size());
+    offsets.assign(nameOffsets, nameOffsets + count + 1);
+    hashes.assign(nameHashes, nameHashes + count);
+    size_t slotCount = 16;
+    while (slotCount < count * 2 + 2) slotCount *= 2;
+    rehash(slotCount);
+}
+
+void NameArena::rehash(size_t slotCount) {
+    slots.assign(slotCount, 0);
+    size_t mask = slotCount - 1;
+    for (std::uint32_t index = 0; index < hashes.size(); ++index) {
+        size_t slot = hashes[index] & mask;
+        while (slots[slot] != 0) slot = (slot + 1) & mask;
+        slots[slot] = index + 1;
+    }
+}
@@ -0,0 +1,55 @@
+#include "parallel.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    for (size_t i = 1; i < threadCount; ++i) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+    waiters.notify_all();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!tasks.empty() || running > 0) {
+        if (!runOne(lock)) waiters.wait(lock);
+    }
+}
+
+// Pops and runs one task with the lock released, returns false if the queue is empty
+bool ThreadPool::runOne(std::unique_lock<std::mutex>& lock) {
+    if (tasks.empty()) return false;
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+    ++running;
+    lock.unlock();
+    task();
+    lock.lock();
+    --running;
+    if (tasks.empty() && running == 0) waiters.notify_all();
+    return true;
+}
+
+void ThreadPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty()) return;
+        runOne(lock);
+    }
+}
@@ -1,99 +1,186 @@
 #include "partitioner.hpp"
+#include "parallel.hpp"
 #include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
 #include <iostream>
 
 using namespace std;
 
+namespace {
+// Removals from a partition search its instances this many times, then
+// index their positions
+constexpr unsigned int maxSearchedRemovals = 8;
+}
+
+
+Partitioner::Partition::Partition(const InstanceTable& table) : table(&table) {}
 
-void Partitioner::Partition::addInstance(Instance inst) {
-    instances.insert(inst);
-    totalBitsize += inst.getBitsize();
+void Partitioner::Partition::addInstance(InstanceId id) {
+    if (!slots.empty()) slots.emplace(id, static_cast<std::uint32_t>(instances.size()));
+    instances.push_back(id);
+    float x = table->getX(id), y = table->getY(id);
+    unsigned int bitsize = table->getBitsize(id);
+    totalBitsize += bitsize;
+    sumWeightedX += double(x) * bitsize;
+    sumWeightedY += double(y) * bitsize;
+    sumX += x;
+    sumY += y;
+
+    if (bitsize >= bitsizeCounts.size()) bitsizeCounts.resize(bitsize + 1, 0);
+    ++bitsizeCounts[bitsize];
 
-    // Update center of weight (weighted by bitsize)
-    float totalWeight = static_cast<float>(totalBitsize);
     if (instances.size() == 1) {
-        centerLoc = inst.getLocation();
-    } else {
-        // Weighted average update
-        float prevWeight = totalWeight - inst.getBitsize();
-        centerLoc.x = (centerLoc.x * prevWeight + inst.getLocation().x * inst.getBitsize()) / totalWeight;
-        centerLoc.y = (centerLoc.y * prevWeight + inst.getLocation().y * inst.getBitsize()) / totalWeight;
+        bbox = BoundingBox(x, y, x, y);
+        bboxDirty = false;
+    } else if (!bboxDirty) {
+        bbox.ll.x = std::min(bbox.ll.x, x);
+        bbox.ll.y = std::min(bbox.ll.y, y);
+        bbox.ur.x = std::max(bbox.ur.x, x);
+        bbox.ur.y = std::max(bbox.ur.y, y);
     }
+    updateCenter();
 }
 
-void Partitioner::Partition::removeInstance(Instance inst) {
-    auto it = instances.find(inst);
-    if (it == instances.end()) return;
+void Partitioner::Partition::removeInstance(InstanceId id) {
+    std::uint32_t slot;
+    if (slots.empty() && ++searchedRemovals <= maxSearchedRemovals) {
+        auto it = std::find(instances.begin(), instances.end(), id);
+        if (it == instances.end()) return;
+        slot = static_cast<std::uint32_t>(it - instances.begin());
+        instances[slot] = instances.back();
+    } else {
+        if (slots.empty()) {
+            slots.reserve(instances.size());
+            for (size_t i = 0; i < instances.size(); ++i) slots.emplace(instances[i], static_cast<std::uint32_t>(i));
+        }
+        auto it = slots.find(id);
+        if (it == slots.end()) return;
+        slot = it->second;
+        slots.erase(it);
+        if (slot + 1 != instances.size()) {
+            instances[slot] = instances.back();
+            slots[instances[slot]] = slot;
+        }
+    }
+    instances.pop_back();
 
-    unsigned int removedBitsize = it->getBitsize();
-    instances.erase(it);
-    totalBitsize -= removedBitsize;
+    float x = table->getX(id), y = table->getY(id);
+    unsigned int bitsize = table->getBitsize(id);
+    totalBitsize -= bitsize;
+    --bitsizeCounts[bitsize];
 
-    // Recalculate center of weight (weighted by bitsize)
     if (instances.empty()) {
+        sumWeightedX = sumWeightedY = sumX = sumY = 0;
+        bbox = BoundingBox();
+        bboxDirty = false;
         centerLoc = Point2D(0, 0);
         return;
     }
 
-    float sumX = 0.0f, sumY = 0.0f;
-    unsigned int sumBits = 0;
-    for (const auto& i : instances) {
-        sumX += i.getLocation().x * i.getBitsize();
-        sumY += i.getLocation().y * i.getBitsize();
-        sumBits += i.getBitsize();
-    }
-    centerLoc.x = sumX / sumBits;
-    centerLoc.y = sumY / sumBits;
-}
-
-const float Partitioner::Partition::getTotalRoutingDistance() {
-    if (instances.size() < 2) return 0.0f;
-    float total = 0.0f;
-    // Copy to vector for easier pairwise iteration
-    std::vector<const Instance*> vec;
-    for (const auto& inst : instances) vec.push_back(&inst);
-
-    for (size_t i = 0; i < vec.size(); ++i) {
-        float minDist = std::numeric_limits<float>::max();
-        for (size_t j = 0; j < vec.size(); ++j) {
-            if (i == j) continue;
-            float dist = vec[i]->distanceTo(*vec[j]);
-            if (dist < minDist) minDist = dist;
-        }
-        if (minDist < std::numeric_limits<float>::max())
-            total += minDist;
+    sumWeightedX -= double(x) * bitsize;
+    sumWeightedY -= double(y) * bitsize;
+    sumX -= x;
+    sumY -= y;
+    // Only an instance on the edge can shrink the box
+    if (x == bbox.ll.x || x == bbox.ur.x || y == bbox.ll.y || y == bbox.ur.y) bboxDirty = true;
+    updateCenter();
+}
+
+void Partitioner::Partition::updateCenter() {
+    if (totalBitsize > 0) {
+        centerLoc.x = static_cast<float>(sumWeightedX / totalBitsize);
+        centerLoc.y = static_cast<float>(sumWeightedY / totalBitsize);
+    } else {
+        centerLoc.x = static_cast<float>(sumX / instances.size());
+        centerLoc.y = static_cast<float>(sumY / instances.size());
     }
-    return total;
 }
 
-size_t Partitioner::countGridInstancesMissedInPartitions() const {
-    // Collect all instances from the grid
-    std::unordered_set<Instance> gridInstances;
-    for (const auto& cell : grid.getGrid()) {
-        for (const auto& inst : cell.second) {
-            gridInstances.insert(inst);
+const BoundingBox& Partitioner::Partition::getBoundingBox() const {
+    if (bboxDirty) {
+        bbox = BoundingBox(table->getLocation(instances[0]), table->getLocation(instances[0]));
+        for (InstanceId i : instances) {
+            bbox.ll.x = std::min(bbox.ll.x, table->getX(i));
+            bbox.ll.y = std::min(bbox.ll.y, table->getY(i));
+            bbox.ur.x = std::max(bbox.ur.x, table->getX(i));
+            bbox.ur.y = std::max(bbox.ur.y, table->getY(i));
         }
+        bboxDirty = false;
     }
+    return bbox;
+}
 
-    // Collect all instances from all partitions
-    std::unordered_set<Instance> partitionInstances;
-    for (const auto& partition : partitions) {
-        for (const auto& inst : partition.instances) {
-            partitionInstances.insert(inst);
-        }
+unsigned int Partitioner::Partition::getBitsizeCount(unsigned int bitsize) const {
+    return bitsize < bitsizeCounts.size() ? bitsizeCounts[bitsize] : 0;
+}
+
+unsigned int Partitioner::Partition::getMaxInstanceBitsize() const {
+    for (size_t b = bitsizeCounts.size(); b > 0; --b) {
+        if (bitsizeCounts[b - 1] > 0) return static_cast<unsigned int>(b - 1);
     }
+    return 0;
+}
+
+float Partitioner::Partition::getFillLevel(unsigned int bitsizeLimit) const {
+    return bitsizeLimit == 0 ? 0.0f : static_cast<float>(totalBitsize) / bitsizeLimit;
+}
+
+float Partitioner::Partition::getTotalRoutingDistance() const {
+    return static_cast<float>(measureNearestNeighbourLength(*table, instances.data(), instances.size()));
+}
 
-    // Count how many grid instances are missing from partitions
-    size_t missed = 0;
-    for (const auto& inst : gridInstances) {
-        if (partitionInstances.find(inst) == partitionInstances.end()) {
-            ++missed;
+size_t Partitioner::countGridInstancesMissedInPartitions() const {
+    return validate().missedInstances;
+}
+
+PartitionValidation Partitioner::validate() const {
+    PartitionValidation report;
+    size_t instanceCount = grid.getInstances().size();
+
+    // One bit per instance, set atomically so partitions can be walked in parallel
+    std::vector<std::atomic<std::uint64_t>> covered((instanceCount + 63) / 64);
+    for (auto& word : covered) word.store(0, std::memory_order_relaxed);
+    std::atomic<size_t> duplicates(0);
+    std::vector<char> overLimit(partitions.size(), 0);
+
+    ThreadPool pool(threadCount);
+    pool.parallelFor(partitions.size(), [&](size_t i) {
+        size_t localDuplicates = 0;
+        for (InstanceId id : partitions[i].instances) {
+            std::uint64_t mask = std::uint64_t(1) << (id % 64);
+            if (covered[id / 64].fetch_or(mask, std::memory_order_relaxed) & mask) ++localDuplicates;
+        }
+        if (localDuplicates) duplicates += localDuplicates;
+        overLimit[i] = partitions[i].totalBitsize > bitsizeLimit;
+    });
+
+    // Removed instances must not be in any partition, they do not count as covered
+    if (grid.getInstanceCount() != instanceCount) {
+        for (InstanceId id = 0; id < instanceCount; ++id) {
+            if (!grid.isRemoved(id)) continue;
+            std::uint64_t mask = std::uint64_t(1) << (id % 64);
+            if (covered[id / 64].fetch_and(~mask, std::memory_order_relaxed) & mask) ++report.removedInstances;
         }
     }
-    return missed;
+    size_t coveredCount = 0;
+    for (const auto& word : covered) coveredCount += std::bitset<64>(word.load(std::memory_order_relaxed)).count();
+    report.missedInstances = grid.getInstanceCount() - coveredCount;
+    report.duplicateInstances = duplicates;
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        if (overLimit[i]) report.overLimitPartitions.push_back(i);
+        if (partitions[i].instances.empty()) report.emptyPartitions.push_back(i);
+    }
+    return report;
 }
+
 Partitioner::Partitioner(InstanceGrid& grid, unsigned int bitsizeLimit)
-    : grid(grid), bitsizeLimit(bitsizeLimit) {}
+    : grid(grid), bitsizeLimit(bitsizeLimit), threadCount(getDefaultThreadCount()) {}
+
+void Partitioner::setThreadCount(size_t count) {
+    threadCount = std::max<size_t>(1, count);
+}
 
 float Partitioner::getPartitionAverageBitSize() {
     if (partitions.empty()) return 0;
@@ -104,7 +191,7 @@ float Partitioner::getPartitionAverageBitSize() {
     return total / partitions.size();
 }
 
-size_t Partitioner::getViolatingBitLimitPartitionCount() {
+size_t Partitioner::getViolatingBitLimitPartitionCount() const {
     size_t count = 0;
     for (const auto& partition : partitions) {
         if (partition.totalBitsize > bitsizeLimit) ++count;
@@ -118,11 +205,30 @@ const std::vector<Partitioner::Partition>& Partitioner::getPartitions() {
     if (partitions.empty()) throw new runtime_error("No partitition generated yet");
     return partitions;
 }
-float Partitioner::getPartitionsTotalRoutingLength() {
-    float total = 0;
-    for(auto partition : partitions) {
-        total += partition.getTotalRoutingDistance();
-    }
-    return total;
+float Partitioner::getPartitionsTotalRoutingLength() const {
+    std::vector<double> lengths(partitions.size());
+    ThreadPool pool(threadCount);
+    pool.parallelFor(partitions.size(), [&](size_t i) {
+        const auto& partition = partitions[i];
+        lengths[i] = measureNearestNeighbourLength(grid.getInstances(), partition.instances.data(), partition.instances.size());
+    });
+    // Summed in partition order so the result does not depend on the thread count
+    double total = 0;
+    for (double length : lengths) total += length;
+    return static_cast<float>(total);
+}
+
+std::vector<RoutingMetrics> Partitioner::getPartitionRoutingMetrics() const {
+    std::vector<RoutingMetrics> metrics(partitions.size());
+    ThreadPool pool(threadCount);
+    pool.parallelFor(partitions.size(), [&](size_t i) {
+        metrics[i] = measureRouting(grid.getInstances(), partitions[i].instances);
+    });
+    return metrics;
 }
 
+RoutingMetrics Partitioner::getRoutingMetrics() const {
+    RoutingMetrics total;
+    for (const auto& metrics : getPartitionRoutingMetrics()) total += metrics;
+    return total;
+}
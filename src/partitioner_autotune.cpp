@@ -0,0 +1,244 @@
+#include "partitioner.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+
+namespace {
+
+// Candidate bin sizes as fractions of the localized band height
+constexpr double candidateFractions[] = {1.0 / 32, 1.0 / 16, 1.0 / 8, 1.0 / 4, 1.0 / 2, 1.0};
+// Average instances per density histogram cell
+constexpr double instancesPerCell = 16;
+// Route length lost against an infinitely fine grid is about
+// lossScale * r^lossExponent, r being the bin area times the band height over
+// the bin width, in partitions. Fitted on uniform and clustered 1M designs.
+constexpr double lossScale = 0.25;
+constexpr double lossExponent = 1.7;
+constexpr double maxLossRatio = 4;
+// Single thread cost per instance (scaled by the window overlap) and per bin
+constexpr double nsPerInstance = 50;
+constexpr double nsPerBin = 2;
+// The dense index costs 4 bytes per bin, larger grids are not considered
+constexpr double maxBinsPerInstance = 16;
+// Candidates this close to the best predicted loss count as equal, the fastest wins
+constexpr double lossTolerance = 0.005;
+// Trial runs use a window of the design with about this many instances
+constexpr size_t maxSampleInstances = 50000;
+constexpr size_t minBlockSize = 1 << 16;
+
+struct DensityHistogram {
+    BoundingBox bounds;
+    double cellSize = 1;
+    int nx = 1;
+    int ny = 1;
+    std::vector<std::uint32_t> counts;  // column by column
+};
+
+// One pass over the table, blocks count into private histograms that are
+// summed at the end
+DensityHistogram buildDensityHistogram(const InstanceGrid& grid, size_t threadCount) {
+    DensityHistogram hist;
+    hist.bounds = grid.getBounds();
+    const InstanceTable& table = grid.getInstances();
+    double width = hist.bounds.ur.x - hist.bounds.ll.x;
+    double height = hist.bounds.ur.y - hist.bounds.ll.y;
+    double cellCount = std::max(1.0, grid.getInstanceCount() / instancesPerCell);
+    // Designs on a line or a point get cells along the longer side
+    if (width > 0 && height > 0) hist.cellSize = std::sqrt(width * height / cellCount);
+    else if (width > 0 || height > 0) hist.cellSize = std::max(width, height) / cellCount;
+    hist.nx = int(width / hist.cellSize) + 1;
+    hist.ny = int(height / hist.cellSize) + 1;
+    size_t size = size_t(hist.nx) * hist.ny;
+
+    size_t count = table.size();
+    size_t blockCount = std::max<size_t>(1, std::min(threadCount, count / minBlockSize));
+    size_t blockSize = (count + blockCount - 1) / blockCount;
+    std::vector<std::vector<std::uint32_t>> blocks(blockCount);
+    parallelFor(blockCount, threadCount, [&](size_t block) {
+        std::vector<std::uint32_t>& local = blocks[block];
+        local.assign(size, 0);
+        size_t last = std::min(count, (block + 1) * blockSize);
+        for (InstanceId id = InstanceId(block * blockSize); id < last; ++id) {
+            if (grid.isRemoved(id)) continue;
+            int cx = std::min(hist.nx - 1, int((table.getX(id) - hist.bounds.ll.x) / hist.cellSize));
+            int cy = std::min(hist.ny - 1, int((table.getY(id) - hist.bounds.ll.y) / hist.cellSize));
+            ++local[size_t(cx) * hist.ny + cy];
+        }
+    });
+    hist.counts = std::move(blocks[0]);
+    for (size_t block = 1; block < blockCount; ++block) {
+        for (size_t i = 0; i < size; ++i) hist.counts[i] += blocks[block][i];
+    }
+    return hist;
+}
+
+size_t countBins(const BoundingBox& bounds, double binSize) {
+    double nx = std::floor(bounds.ur.x / binSize) - std::floor(bounds.ll.x / binSize) + 1;
+    double ny = std::floor(bounds.ur.y / binSize) - std::floor(bounds.ll.y / binSize) + 1;
+    return size_t(nx * ny);
+}
+
+double predictMs(size_t instances, size_t bins, double binSize, double bandHeight, size_t threadCount) {
+    double overlap = bandHeight > 0 ? 1 + binSize / bandHeight : 2;
+    return (nsPerInstance * instances * overlap / threadCount + nsPerBin * bins) * 1e-6;
+}
+
+double getBandHeight(const BoundingBox& bounds, size_t totalBitSize, unsigned int maxBitSize,
+                     unsigned int bitsizeLimit, size_t bandCount) {
+    double height = bounds.ur.y - bounds.ll.y;
+    if (height > 0) return height / bandCount;
+    // A single row: square partitions along it
+    double partitions = std::max(1.0, std::ceil(double(totalBitSize) / (bitsizeLimit - maxBitSize)));
+    return std::max(1e-3, double(bounds.ur.x - bounds.ll.x) / partitions);
+}
+
+}
+
+// Predicts the runtime and the route length of partitionLocalized for bin
+// sizes between 1/32 and one band height. The runtime is linear in the
+// instances, growing with the window overlap, plus the dense bin index. The
+// loss comes from the local density: a bin holding a large part of a
+// partition forces whole bins into partitions that do not fit them.
+BinSizeTuning Partitioner::tuneLocalizedBinSize(const InstanceGrid& grid, unsigned int bitsizeLimit,
+                                                double budgetMs, bool runTrials, size_t threadCount) {
+    BinSizeTuning tuning;
+    tuning.binSize = grid.getBinSize();
+    size_t instanceCount = grid.getInstanceCount();
+    if (instanceCount == 0 || bitsizeLimit <= grid.getMaxBitSize()) return tuning;
+    threadCount = std::max<size_t>(1, threadCount);
+
+    const BoundingBox& bounds = grid.getBounds();
+    size_t bandCount = getLocalizedBandCount(bounds, grid.getTotalBitSize(), grid.getMaxBitSize(), bitsizeLimit);
+    double bandHeight = getBandHeight(bounds, grid.getTotalBitSize(), grid.getMaxBitSize(), bitsizeLimit, bandCount);
+    double meanBitSize = double(grid.getTotalBitSize()) / instanceCount;
+    double partitionInstances = meanBitSize > 0 ? (bitsizeLimit - grid.getMaxBitSize()) / meanBitSize : 0;
+
+    DensityHistogram hist = buildDensityHistogram(grid, threadCount);
+    double cellArea = hist.cellSize * hist.cellSize;
+
+    for (double fraction : candidateFractions) {
+        BinSizeCandidate candidate;
+        candidate.binSize = float(bandHeight * fraction);
+        size_t bins = countBins(bounds, candidate.binSize);
+        bool coarsest = fraction == candidateFractions[std::size(candidateFractions) - 1];
+        if (bins > maxBinsPerInstance * instanceCount && !coarsest) continue;
+        candidate.predictedMs = predictMs(instanceCount, bins, candidate.binSize, bandHeight, threadCount);
+        if (partitionInstances > 0) {
+            // Weighted by the route length of the cell, about count / sqrt(density)
+            double weighted = 0;
+            double length = 0;
+            for (std::uint32_t count : hist.counts) {
+                if (count == 0) continue;
+                double density = count / cellArea;
+                double ratio = candidate.binSize * bandHeight * density / partitionInstances;
+                double cellLength = count / std::sqrt(density);
+                weighted += cellLength * lossScale * std::pow(std::min(ratio, maxLossRatio), lossExponent);
+                length += cellLength;
+            }
+            candidate.predictedLoss = weighted / length;
+        }
+        tuning.candidates.push_back(candidate);
+    }
+
+    if (runTrials) {
+        // Window around the cell at the instance weighted median density, so
+        // the sample sees the density most instances see
+        BoundingBox window = bounds;
+        if (instanceCount > maxSampleInstances) {
+            std::vector<std::uint32_t> cells;
+            for (std::uint32_t cell = 0; cell < hist.counts.size(); ++cell) {
+                if (hist.counts[cell] > 0) cells.push_back(cell);
+            }
+            std::sort(cells.begin(), cells.end(), [&](std::uint32_t a, std::uint32_t b) {
+                return hist.counts[a] < hist.counts[b] || (hist.counts[a] == hist.counts[b] && a < b);
+            });
+            size_t seen = 0;
+            std::uint32_t median = cells.back();
+            for (std::uint32_t cell : cells) {
+                seen += hist.counts[cell];
+                if (seen * 2 >= instanceCount) {
+                    median = cell;
+                    break;
+                }
+            }
+            double density = hist.counts[median] / cellArea;
+            double half = std::sqrt(maxSampleInstances / density) / 2;
+            double cx = hist.bounds.ll.x + (median / hist.ny + 0.5) * hist.cellSize;
+            double cy = hist.bounds.ll.y + (median % hist.ny + 0.5) * hist.cellSize;
+            window = BoundingBox(float(cx - half), float(cy - half), float(cx + half), float(cy + half));
+        }
+
+        InstanceGrid sample(grid.getBinSize());
+        const InstanceTable& table = grid.getInstances();
+        for (InstanceId id = 0; id < table.size(); ++id) {
+            float x = table.getX(id), y = table.getY(id);
+            if (grid.isRemoved(id) || x < window.ll.x || x > window.ur.x || y < window.ll.y || y > window.ur.y) continue;
+            sample.addInstance(std::string_view(), x, y, table.getBitsize(id));
+        }
+        tuning.sampleInstances = sample.getInstanceCount();
+
+        if (tuning.sampleInstances > 0 && sample.getMaxBitSize() < bitsizeLimit) {
+            const BoundingBox& sampleBounds = sample.getBounds();
+            size_t sampleBands = getLocalizedBandCount(sampleBounds, sample.getTotalBitSize(),
+                                                       sample.getMaxBitSize(), bitsizeLimit);
+            double sampleBandHeight = getBandHeight(sampleBounds, sample.getTotalBitSize(),
+                                                    sample.getMaxBitSize(), bitsizeLimit, sampleBands);
+            double measuredMs = 0;
+            double modelMs = 0;
+            double bestLength = 0;
+            for (BinSizeCandidate& candidate : tuning.candidates) {
+                size_t bins = countBins(sampleBounds, candidate.binSize);
+                if (bins > maxBinsPerInstance * tuning.sampleInstances) continue;
+                sample.setBinSize(candidate.binSize);
+                Partitioner partitioner(sample, bitsizeLimit);
+                partitioner.setThreadCount(threadCount);
+                auto start = std::chrono::steady_clock::now();
+                partitioner.partitionLocalized();
+                auto stop = std::chrono::steady_clock::now();
+                candidate.sampledMs = std::chrono::duration<double, std::milli>(stop - start).count();
+                candidate.sampledLength = partitioner.getPartitionsTotalRoutingLength();
+                measuredMs += candidate.sampledMs;
+                modelMs += predictMs(tuning.sampleInstances, bins, candidate.binSize, sampleBandHeight, threadCount);
+                if (bestLength == 0 || candidate.sampledLength < bestLength) bestLength = candidate.sampledLength;
+            }
+            // The trials replace the modelled loss and rescale the modelled runtime
+            double scale = modelMs > 0 && measuredMs > 0 ? measuredMs / modelMs : 1;
+            for (BinSizeCandidate& candidate : tuning.candidates) {
+                candidate.predictedMs *= scale;
+                if (candidate.sampledLength >= 0 && bestLength > 0) {
+                    candidate.predictedLoss = candidate.sampledLength / bestLength - 1;
+                }
+            }
+        }
+    }
+
+    // Lowest loss within the budget, then the fastest of the candidates
+    // about as good. Without a fitting candidate the fastest one. After
+    // trials only the sampled candidates compete, a measured loss and a
+    // modelled one are not on the same scale.
+    bool sampled = false;
+    for (const BinSizeCandidate& candidate : tuning.candidates) sampled |= candidate.sampledLength >= 0;
+    auto eligible = [&](const BinSizeCandidate& candidate) { return !sampled || candidate.sampledLength >= 0; };
+    const BinSizeCandidate* fastest = nullptr;
+    double bestLoss = -1;
+    for (const BinSizeCandidate& candidate : tuning.candidates) {
+        if (!eligible(candidate)) continue;
+        if (!fastest || candidate.predictedMs < fastest->predictedMs) fastest = &candidate;
+        if (budgetMs > 0 && candidate.predictedMs > budgetMs) continue;
+        if (bestLoss < 0 || candidate.predictedLoss < bestLoss) bestLoss = candidate.predictedLoss;
+    }
+    const BinSizeCandidate* chosen = bestLoss < 0 ? fastest : nullptr;
+    if (!chosen) {
+        for (const BinSizeCandidate& candidate : tuning.candidates) {
+            if (!eligible(candidate)) continue;
+            if (budgetMs > 0 && candidate.predictedMs > budgetMs) continue;
+            if (candidate.predictedLoss > bestLoss + lossTolerance) continue;
+            if (!chosen || candidate.predictedMs < chosen->predictedMs) chosen = &candidate;
+        }
+    }
+    if (chosen) tuning.binSize = chosen->binSize;
+    return tuning;
+}
@@ -0,0 +1,156 @@
+#include "partitioner.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace {
+
+// Smaller subtrees are split by the task that created them
+constexpr size_t minTaskSize = 1 << 14;
+
+// Instance copy the splits work on, so the selection reads memory in order
+struct Record {
+    float x;
+    float y;
+    unsigned int bitsize;
+    InstanceId id;
+};
+
+// Orders along one axis, ties by id so the split does not depend on the
+// order nth_element leaves equal keys in
+template<bool alongX>
+bool axisLess(const Record& a, const Record& b) {
+    float ka = alongX ? a.x : a.y, kb = alongX ? b.x : b.y;
+    return ka < kb || (ka == kb && a.id < b.id);
+}
+
+// Weighted quickselect: reorders [first, last) so that the records before the
+// returned position come first along the axis and hold the bitsize closest to
+// target. A step selects where the target would be if the undecided range had
+// uniform bitsizes and keeps the side the target lies in. After a step that
+// keeps more than half of the range the next one selects the middle, so the
+// range shrinks geometrically, O(n) on average. Both sides stay non-empty.
+template<bool alongX>
+size_t selectWeighted(Record* first, Record* last, std::uint64_t bitsize, std::uint64_t target) {
+    Record* lo = first;
+    Record* hi = last;
+    std::uint64_t before = 0;  // bitsize of [first, lo)
+    std::uint64_t range = bitsize;  // bitsize of [lo, hi)
+    bool guess = true;
+    while (hi - lo > 1) {
+        size_t size = size_t(hi - lo);
+        size_t offset = size / 2;
+        if (guess && range > 0) offset = size_t(double(size) * double(target - before) / double(range));
+        Record* mid = lo + std::min(std::max<size_t>(offset, 1), size - 1);
+        std::nth_element(lo, mid, hi, axisLess<alongX>);
+        std::uint64_t part = 0;
+        for (Record* it = lo; it != mid; ++it) part += it->bitsize;
+        if (before + part >= target) {
+            hi = mid;
+            range = part;
+        } else {
+            before += part;
+            range -= part;
+            lo = mid;
+        }
+        guess = size_t(hi - lo) <= size / 2;
+    }
+    Record* split = lo;
+    if (hi != lo && before + lo->bitsize - target < target - before) split = hi;
+    split = std::min(std::max(split, first + 1), last - 1);
+    return size_t(split - first);
+}
+
+class Bisection {
+public:
+    Bisection(std::vector<Record>& records, unsigned int bitsizeLimit, ThreadPool& pool)
+        : records(records), bitsizeLimit(std::max(1u, bitsizeLimit)), pool(pool) {}
+
+    // Splits [first, last) into count partitions, more when they would not
+    // fit the limit. The subtrees of large parts run as pool tasks.
+    void split(size_t first, size_t last, std::uint64_t count) {
+        std::uint64_t bitsize = 0;
+        BoundingBox box(records[first].x, records[first].y, records[first].x, records[first].y);
+        for (size_t i = first; i < last; ++i) {
+            const Record& r = records[i];
+            bitsize += r.bitsize;
+            box.ll.x = std::min(box.ll.x, r.x);
+            box.ur.x = std::max(box.ur.x, r.x);
+            box.ll.y = std::min(box.ll.y, r.y);
+            box.ur.y = std::max(box.ur.y, r.y);
+        }
+        count = std::max(count, (bitsize + bitsizeLimit - 1) / bitsizeLimit);
+        if (count <= 1 || last - first <= 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            leaves.emplace_back(first, last);
+            return;
+        }
+
+        // The left side gets half of the partitions and the matching share of the bitsize
+        std::uint64_t leftCount = count / 2;
+        std::uint64_t target = bitsize * leftCount / count;
+        bool alongX = box.ur.x - box.ll.x >= box.ur.y - box.ll.y;
+        Record* begin = records.data() + first;
+        Record* end = records.data() + last;
+        size_t middle = first + (alongX ? selectWeighted<true>(begin, end, bitsize, target)
+                                        : selectWeighted<false>(begin, end, bitsize, target));
+
+        visit(first, middle, leftCount);
+        visit(middle, last, count - leftCount);
+    }
+
+    std::vector<std::pair<size_t, size_t>> leaves;  // record ranges, in completion order
+
+private:
+    void visit(size_t first, size_t last, std::uint64_t count) {
+        if (last - first >= minTaskSize) {
+            pool.submit([this, first, last, count]() { split(first, last, count); });
+        } else {
+            split(first, last, count);
+        }
+    }
+
+    std::vector<Record>& records;
+    std::uint64_t bitsizeLimit;
+    ThreadPool& pool;
+    std::mutex mutex;
+};
+
+}
+
+// Recursive coordinate bisection: splits the instances at the weighted median
+// along the longer side of their bounding box until every part fits the
+// limit. No rebalancing is needed. Parts are independent, so large ones are
+// split as parallel tasks. O(N log P), and the result does not depend on the
+// thread count because the leaves are ordered by their place in the records.
+void Partitioner::partitionBisection() {
+    partitions.clear();
+    const InstanceTable& table = grid.getInstances();
+    if (grid.getInstanceCount() == 0) return;
+
+    std::vector<Record> records;
+    records.reserve(grid.getInstanceCount());
+    for (InstanceId id = 0; id < table.size(); ++id) {
+        if (!grid.isRemoved(id)) records.push_back({table.getX(id), table.getY(id), table.getBitsize(id), id});
+    }
+
+    // The partition count keeps the maxBitSize margin of Hilbert and localized,
+    // so the rounding of the splits rarely pushes a part over the limit
+    std::uint64_t partitionBits = bitsizeLimit > grid.getMaxBitSize() ? bitsizeLimit - grid.getMaxBitSize() : 1;
+    std::uint64_t count = (grid.getTotalBitSize() + partitionBits - 1) / partitionBits;
+    ThreadPool pool(threadCount);
+    Bisection bisection(records, bitsizeLimit, pool);
+    pool.submit([&]() { bisection.split(0, records.size(), count); });
+    pool.wait();
+
+    // Left subtrees hold the lower ranges, so this is the depth first leaf order
+    std::vector<std::pair<size_t, size_t>>& leaves = bisection.leaves;
+    std::sort(leaves.begin(), leaves.end());
+    partitions.assign(leaves.size(), Partition(table));
+    pool.parallelFor(leaves.size(), [&](size_t p) {
+        partitions[p].instances.reserve(leaves[p].second - leaves[p].first);
+        for (size_t i = leaves[p].first; i < leaves[p].second; ++i) partitions[p].addInstance(records[i].id);
+    });
+}
@@ -0,0 +1,149 @@
+#include "partitioner.hpp"
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+namespace {
+
+constexpr std::uint32_t noPartition = std::numeric_limits<std::uint32_t>::max();
+// Candidate partitions are searched within this many bins, doubling from one
+constexpr int maxSearchBins = 8;
+
+}
+
+void Partitioner::setPartitions(const std::vector<std::vector<InstanceId>>& assignment) {
+    partitions.clear();
+    const InstanceTable& table = grid.getInstances();
+    for (const auto& ids : assignment) {
+        Partition partition(table);
+        for (InstanceId id : ids) partition.addInstance(id);
+        partitions.push_back(std::move(partition));
+    }
+}
+
+// Deltas are applied in order, moved and added instances are displaced. A
+// moved instance goes back to its partition while it stays within a bin of
+// it. Otherwise it joins the partition with the nearest centre, among those
+// with instances in the surrounding bins, that still has room. If none has
+// room a new partition is opened.
+EcoRepairStats Partitioner::repairPartitions(const std::vector<InstanceDelta>& deltas) {
+    EcoRepairStats stats;
+    const InstanceTable& table = grid.getInstances();
+    float binSize = grid.getBinSize();
+
+    std::vector<std::uint32_t> partitionOf(table.size(), noPartition);
+    for (size_t p = 0; p < partitions.size(); ++p) {
+        for (InstanceId id : partitions[p].instances) partitionOf[id] = static_cast<std::uint32_t>(p);
+    }
+
+    std::unordered_set<std::pair<int, int>, PairHash> dirtyBins;
+    std::vector<char> touched(partitions.size(), 0);
+    // Displaced instances with the partition they left
+    std::vector<std::pair<InstanceId, std::uint32_t>> displaced;
+    std::vector<char> isDisplaced(table.size(), 0);
+
+    // Must run before the grid moves the instance, the partition sums use its location
+    auto detach = [&](InstanceId id) {
+        std::uint32_t p = partitionOf[id];
+        if (p != noPartition) {
+            partitions[p].removeInstance(id);
+            partitionOf[id] = noPartition;
+        }
+        return p;
+    };
+
+    for (const auto& delta : deltas) {
+        InstanceId id = delta.id;
+        if (delta.kind == InstanceDelta::Kind::Add) {
+            id = grid.addInstance(delta.name, delta.x, delta.y, delta.bitsize);
+            partitionOf.push_back(noPartition);
+            isDisplaced.push_back(1);
+            displaced.emplace_back(id, noPartition);
+            dirtyBins.insert(grid.getCell(table.getLocation(id)));
+            stats.addedIds.push_back(id);
+            continue;
+        }
+        if (id >= table.size() || grid.isRemoved(id)) continue;
+        dirtyBins.insert(grid.getCell(table.getLocation(id)));
+        if (delta.kind == InstanceDelta::Kind::Move) {
+            if (!isDisplaced[id]) {
+                isDisplaced[id] = 1;
+                displaced.emplace_back(id, detach(id));
+            }
+            grid.moveInstance(id, delta.x, delta.y);
+            dirtyBins.insert(grid.getCell(table.getLocation(id)));
+        } else {
+            std::uint32_t p = detach(id);
+            if (p != noPartition) touched[p] = 1;
+            isDisplaced[id] = 0;
+            grid.removeInstance(id);
+        }
+    }
+
+    auto fits = [&](std::uint32_t p, unsigned int bitsize) {
+        return partitions[p].totalBitsize + bitsize <= bitsizeLimit;
+    };
+    auto findNearbyPartition = [&](const Point2D& location, unsigned int bitsize) {
+        std::uint32_t best = noPartition;
+        for (int bins = 1; bins <= maxSearchBins && best == noPartition; bins *= 2) {
+            float reach = bins * binSize;
+            BoundingBox box(location.x - reach, location.y - reach, location.x + reach, location.y + reach);
+            float bestDist = std::numeric_limits<float>::max();
+            grid.forEachInstanceWithin(box, [&](InstanceId other) {
+                std::uint32_t p = partitionOf[other];
+                if (p == noPartition || !fits(p, bitsize)) return;
+                const Point2D& center = partitions[p].centerLoc;
+                float dist = std::fabs(center.x - location.x) + std::fabs(center.y - location.y);
+                if (dist < bestDist || (dist == bestDist && p < best)) {
+                    bestDist = dist;
+                    best = p;
+                }
+            });
+        }
+        return best;
+    };
+
+    for (const auto& entry : displaced) {
+        InstanceId id = entry.first;
+        std::uint32_t from = entry.second;
+        if (!isDisplaced[id]) {
+            // Removed after it moved, its partition still lost it
+            if (from != noPartition) touched[from] = 1;
+            continue;
+        }
+        isDisplaced[id] = 0;
+        unsigned int bitsize = table.getBitsize(id);
+        Point2D location = table.getLocation(id);
+
+        std::uint32_t target = noPartition;
+        if (from != noPartition && fits(from, bitsize)) {
+            const Partition& home = partitions[from];
+            const BoundingBox& box = home.getBoundingBox();
+            bool near = home.instances.empty() ||
+                        (location.x >= box.ll.x - binSize && location.x <= box.ur.x + binSize &&
+                         location.y >= box.ll.y - binSize && location.y <= box.ur.y + binSize);
+            if (near) target = from;
+        }
+        if (target == noPartition) target = findNearbyPartition(location, bitsize);
+        if (target == noPartition) {
+            target = static_cast<std::uint32_t>(partitions.size());
+            partitions.emplace_back(table);
+            touched.push_back(0);
+            ++stats.newPartitions;
+        }
+
+        partitions[target].addInstance(id);
+        partitionOf[id] = target;
+        if (target != from) {
+            touched[target] = 1;
+            if (from != noPartition) {
+                touched[from] = 1;
+                ++stats.reassignedInstances;
+            }
+        }
+    }
+
+    stats.dirtyBins = dirtyBins.size();
+    for (char t : touched) stats.touchedPartitions += t;
+    return stats;
+}
@@ -1,17 +1,32 @@
 #include "partitioner.hpp"
+#include <unordered_map>
 
 void Partitioner::partitionHashmap() {
     partitions.clear();
 
-    Partition current;
-    for (auto& it : grid.getGrid()) {
-        for(auto& inst : it.second) {
-            if (current.totalBitsize + inst.getBitsize() > bitsizeLimit && !current.instances.empty()) {
+    const InstanceTable& table = grid.getInstances();
+
+    // Key every non-empty bin by its cell, partitions are filled in hash order
+    std::unordered_map<std::pair<int, int>, InstanceRange, PairHash> buckets;
+    auto firstCell = grid.getFirstCell();
+    for (int ix = 0; ix < grid.getBinCountX(); ++ix) {
+        for (int iy = 0; iy < grid.getBinCountY(); ++iy) {
+            int cx = firstCell.first + ix;
+            int cy = firstCell.second + iy;
+            InstanceRange bin = grid.getBinInstances(cx, cy);
+            if (!bin.empty()) buckets.emplace(std::make_pair(cx, cy), bin);
+        }
+    }
+
+    Partition current(table);
+    for (auto& it : buckets) {
+        for(InstanceId id : it.second) {
+            if (current.totalBitsize + table.getBitsize(id) > bitsizeLimit && !current.instances.empty()) {
                 partitions.push_back(current);
-                current = Partition();
+                current = Partition(table);
             }
             
-            current.addInstance(inst);
+            current.addInstance(id);
         }
     }
     if (!current.instances.empty()) {
@@ -0,0 +1,179 @@
+#include "partitioner.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// Coordinates are quantised to 2^hilbertOrder steps per axis, keys fill 32 bits
+constexpr int hilbertOrder = 16;
+constexpr int radixBits = 8;
+constexpr size_t radixBuckets = size_t(1) << radixBits;
+// Smallest slice of the instances worth a task of its own
+constexpr size_t minBlockSize = 1 << 14;
+
+// Spreads the low 16 bits of x to the even bit positions
+inline std::uint32_t interleaveBits(std::uint32_t x) {
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+// Position of (x, y) along a Hilbert curve of order 16. The orientation of
+// every level is resolved with a parallel prefix scan over the bits, so there
+// are no branches and no loop over the levels and the compiler vectorises
+// the loop that calls it.
+inline std::uint32_t hilbertKey(std::uint32_t x, std::uint32_t y) {
+    std::uint32_t A, B, C, D;
+    {
+        std::uint32_t a = x ^ y;
+        std::uint32_t b = 0xFFFF ^ a;
+        std::uint32_t c = 0xFFFF ^ (x | y);
+        std::uint32_t d = x & (y ^ 0xFFFF);
+        A = a | (b >> 1);
+        B = (a >> 1) ^ a;
+        C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+        D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+    }
+    for (int shift = 2; shift <= 8; shift *= 2) {
+        std::uint32_t a = A, b = B, c = C, d = D;
+        A = (a & (a >> shift)) ^ (b & (b >> shift));
+        B = (a & (b >> shift)) ^ (b & ((a ^ b) >> shift));
+        C ^= (a & (c >> shift)) ^ (b & (d >> shift));
+        D ^= (b & (c >> shift)) ^ ((a ^ b) & (d >> shift));
+    }
+    std::uint32_t a = C ^ (C >> 1);
+    std::uint32_t b = D ^ (D >> 1);
+    std::uint32_t i0 = x ^ y;
+    std::uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+    return (interleaveBits(i1) << 1) | interleaveBits(i0);
+}
+
+// Stable LSD radix sort of ids by keys. Every pass histograms the blocks in
+// parallel, then scatters each block from its own offsets, so the order does
+// not depend on the thread count.
+void radixSort(std::vector<std::uint32_t>& keys, std::vector<InstanceId>& ids, ThreadPool& pool) {
+    size_t count = keys.size();
+    size_t blockCount = std::max<size_t>(1, std::min(pool.getThreadCount() * 4, count / minBlockSize));
+    size_t blockSize = (count + blockCount - 1) / blockCount;
+    std::vector<std::uint32_t> keysOut(count);
+    std::vector<InstanceId> idsOut(count);
+    std::vector<size_t> offsets(blockCount * radixBuckets);
+
+    for (int shift = 0; shift < 32; shift += radixBits) {
+        pool.parallelFor(blockCount, [&](size_t block) {
+            size_t* histogram = &offsets[block * radixBuckets];
+            std::fill(histogram, histogram + radixBuckets, 0);
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; ++i) ++histogram[(keys[i] >> shift) & (radixBuckets - 1)];
+        });
+        // Skip passes where every key has the same digit
+        bool trivial = false;
+        for (size_t digit = 0; digit < radixBuckets && !trivial; ++digit) {
+            size_t total = 0;
+            for (size_t block = 0; block < blockCount; ++block) total += offsets[block * radixBuckets + digit];
+            trivial = total == count;
+        }
+        if (trivial) continue;
+
+        size_t position = 0;
+        for (size_t digit = 0; digit < radixBuckets; ++digit) {
+            for (size_t block = 0; block < blockCount; ++block) {
+                size_t n = offsets[block * radixBuckets + digit];
+                offsets[block * radixBuckets + digit] = position;
+                position += n;
+            }
+        }
+        pool.parallelFor(blockCount, [&](size_t block) {
+            size_t* cursor = &offsets[block * radixBuckets];
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; ++i) {
+                size_t to = cursor[(keys[i] >> shift) & (radixBuckets - 1)]++;
+                keysOut[to] = keys[i];
+                idsOut[to] = ids[i];
+            }
+        });
+        keys.swap(keysOut);
+        ids.swap(idsOut);
+    }
+}
+
+}
+
+// Orders the instances along a Hilbert curve over the design and cuts the
+// curve into partitions. With the exclusive bitsize prefix P of an instance
+// and T = limit - maxBitSize, the instance goes to chunk floor(P / T), which
+// keeps every chunk below the limit and lets each block cut independently.
+void Partitioner::partitionHilbert() {
+    partitions.clear();
+    const InstanceTable& table = grid.getInstances();
+    size_t count = grid.getInstanceCount();
+    if (count == 0) return;
+
+    ThreadPool pool(threadCount);
+    size_t blockCount = std::max<size_t>(1, std::min(pool.getThreadCount() * 4, count / minBlockSize));
+    size_t blockSize = (count + blockCount - 1) / blockCount;
+    auto forEachBlock = [&](auto&& fn) {
+        pool.parallelFor(blockCount, [&](size_t block) {
+            fn(block, block * blockSize, std::min(count, (block + 1) * blockSize));
+        });
+    };
+
+    // Quantise on a square so the curve cells are square
+    const BoundingBox& bounds = grid.getBounds();
+    float side = std::max(bounds.ur.x - bounds.ll.x, bounds.ur.y - bounds.ll.y);
+    float steps = float((1u << hilbertOrder) - 1);
+    float scale = side > 0 ? steps / side : 0.0f;
+    float minX = bounds.ll.x, minY = bounds.ll.y;
+    // Keys are computed in table order, the columns are read sequentially
+    std::vector<InstanceId> ids;
+    ids.reserve(count);
+    for (InstanceId id = 0; id < table.size(); ++id) {
+        if (!grid.isRemoved(id)) ids.push_back(id);
+    }
+    std::vector<std::uint32_t> keys(count);
+    const float* xs = table.getXs();
+    const float* ys = table.getYs();
+    forEachBlock([&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            float qx = std::min(std::max((xs[ids[i]] - minX) * scale, 0.0f), steps);
+            float qy = std::min(std::max((ys[ids[i]] - minY) * scale, 0.0f), steps);
+            keys[i] = hilbertKey(std::uint32_t(qx), std::uint32_t(qy));
+        }
+    });
+    radixSort(keys, ids, pool);
+
+    // Exclusive bitsize prefix along the curve, block sums first
+    std::vector<std::uint64_t> blockStart(blockCount + 1, 0);
+    forEachBlock([&](size_t block, size_t first, size_t last) {
+        std::uint64_t sum = 0;
+        for (size_t i = first; i < last; ++i) sum += table.getBitsize(ids[i]);
+        blockStart[block + 1] = sum;
+    });
+    for (size_t block = 0; block < blockCount; ++block) blockStart[block + 1] += blockStart[block];
+
+    // A chunk starts wherever the chunk index changes, empty chunks are skipped
+    std::uint64_t chunkBits = bitsizeLimit > grid.getMaxBitSize() ? bitsizeLimit - grid.getMaxBitSize() : 1;
+    std::vector<std::vector<size_t>> blockCuts(blockCount);
+    forEachBlock([&](size_t block, size_t first, size_t last) {
+        std::uint64_t sum = blockStart[block];
+        std::uint64_t previous = first == 0 ? std::uint64_t(-1) : (sum - table.getBitsize(ids[first - 1])) / chunkBits;
+        for (size_t i = first; i < last; ++i) {
+            std::uint64_t chunk = sum / chunkBits;
+            if (chunk != previous) blockCuts[block].push_back(i);
+            previous = chunk;
+            sum += table.getBitsize(ids[i]);
+        }
+    });
+    std::vector<size_t> cuts;
+    for (const auto& block : blockCuts) cuts.insert(cuts.end(), block.begin(), block.end());
+    cuts.push_back(count);
+
+    partitions.assign(cuts.size() - 1, Partition(table));
+    pool.parallelFor(partitions.size(), [&](size_t p) {
+        partitions[p].instances.reserve(cuts[p + 1] - cuts[p]);
+        for (size_t i = cuts[p]; i < cuts[p + 1]; ++i) partitions[p].addInstance(ids[i]);
+    });
+}
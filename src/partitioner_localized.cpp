@@ -1,24 +1,17 @@
 #include "partitioner.hpp"
-
-void Partitioner::partitionLocalized() {
-    partitions.clear();
-
-    // Get grid bounds
-    BoundingBox bounds = grid.getBounds();
-    float minX = bounds.ll.x;
-    float maxX = bounds.ur.x;
-    float minY = bounds.ll.y;
-    float maxY = bounds.ur.y;
-    float width = maxX - minX;
-    float height = maxY - minY;
-
-    // Calculate number of partitions (bins) to make bins as square as possible (like merging)
-    size_t totalBitSize = grid.getTotalBitSize();
-    if (bitsizeLimit == 0) return;
-    size_t numPartitions = std::max<size_t>(1, ceil(float(totalBitSize) / (bitsizeLimit - grid.getMaxBitSize())));
-
-    // Find grid of bins (nx, ny) such that nx * ny >= numPartitions and bins are as square as possible
-    size_t bestNx = 1, bestNy = numPartitions;
+#include "parallel.hpp"
+#include <limits>
+
+// Picks nx * ny >= the partition count with bins as square as possible
+// (like merging) and returns ny
+size_t Partitioner::getLocalizedBandCount(const BoundingBox& bounds, size_t totalBitSize,
+                                          unsigned int maxBitSize, unsigned int bitsizeLimit) {
+    if (bitsizeLimit == 0) return 0;
+    float width = bounds.ur.x - bounds.ll.x;
+    float height = bounds.ur.y - bounds.ll.y;
+    size_t numPartitions = std::max<size_t>(1, ceil(float(totalBitSize) / (bitsizeLimit - maxBitSize)));
+
+    size_t bestNy = numPartitions;
     float bestRatio = std::numeric_limits<float>::max();
     for (size_t nx = 1; nx <= numPartitions; ++nx) {
         size_t ny = (numPartitions + nx - 1) / nx; // ceil division
@@ -27,96 +20,133 @@ void Partitioner::partitionLocalized() {
         float ratio = std::abs(binW - binH);
         if (ratio < bestRatio) {
             bestRatio = ratio;
-            bestNx = nx;
             bestNy = ny;
         }
     }
+    return bestNy;
+}
+
+// Band edges are shared, the last band ends exactly on the bounds
+BoundingBox Partitioner::getLocalizedBand(const BoundingBox& bounds, size_t bandCount, size_t band) {
+    float binH = (bounds.ur.y - bounds.ll.y) / bandCount;
+    float bottom = bounds.ll.y + band * binH;
+    float top = (band == bandCount - 1) ? bounds.ur.y : (bounds.ll.y + (band + 1) * binH);
+    return BoundingBox(Point2D(bounds.ll.x, bottom), Point2D(bounds.ur.x, top));
+}
+
+void Partitioner::partitionLocalized() {
+    partitions.clear();
 
+    BoundingBox bounds = grid.getBounds();
+    size_t bandCount = getLocalizedBandCount(bounds, grid.getTotalBitSize(), grid.getMaxBitSize(), bitsizeLimit);
+    if (bandCount == 0) return;
+
+    unsigned int fillThreshold = bitsizeLimit - grid.getMaxBitSize();
+    grid.buildIndex();
+
+    // Row bands only share their leftovers, sweep them concurrently into
+    // per band buffers and merge in band order
+    std::vector<std::vector<Partition>> bandPartitions(bandCount);
+    std::vector<std::vector<InstanceId>> bandLeftovers(bandCount);
+    ThreadPool pool(threadCount);
+    pool.parallelFor(bandCount, [&](size_t iy) {
+        sweepLocalizedBand(getLocalizedBand(bounds, bandCount, iy), iy == 0, fillThreshold,
+                           bandPartitions[iy], bandLeftovers[iy]);
+    });
+
+    std::vector<InstanceId> leftovers;
+    for (size_t iy = 0; iy < bandCount; ++iy) {
+        for (auto& partition : bandPartitions[iy]) {
+            partitions.push_back(std::move(partition));
+        }
+        leftovers.insert(leftovers.end(), bandLeftovers[iy].begin(), bandLeftovers[iy].end());
+    }
+
+    packLocalizedReminders(leftovers, fillThreshold, partitions);
+}
+
+// Sweeps one row band left to right in windows one bin wide and fills
+// partitions in visiting order. Window edges are shared, an instance on an
+// edge belongs to the window (or band) visited first. What is left in the
+// last unfilled partition is returned in leftovers.
+void Partitioner::sweepLocalizedBand(const BoundingBox& band, bool ownsBottomEdge, unsigned int fillThreshold,
+                                     std::vector<Partition>& out, std::vector<InstanceId>& leftovers) const {
+    const InstanceTable& table = grid.getInstances();
     float binW = grid.getBinSize();
-    float binH = height / bestNy;
 
-    // Track visited instances to avoid duplicates
-    std::unordered_set<Instance> visited;
+    Partition current(table);
+
+    float curX = band.ll.x;
+    bool firstWindow = true;
+    // Runs at least once so bands of zero width are not dropped
+    do {
+        // Gather all instances in the current window
+        float right = (curX + binW > band.ur.x) ? band.ur.x : (curX + binW);
+        BoundingBox box(Point2D(curX, band.ll.y), Point2D(right, band.ur.y));
+
+        grid.forEachInstanceWithin(box, [&](InstanceId id) {
+            // Skip instances already taken by the previous window or band
+            if (!firstWindow && table.getX(id) == curX) return;
+            if (!ownsBottomEdge && table.getY(id) == band.ll.y) return;
+            // Fill partition up to bitsizeLimit
+            current.addInstance(id);
+            if(current.totalBitsize >= fillThreshold) {
+                out.push_back(std::move(current));
+                current = Partition(table);
+            }
+        });
+        curX = right;
+        firstWindow = false;
+    } while (curX < band.ur.x);
+    leftovers = std::move(current.instances);
+}
 
-    Partition current;
+// Packs the band leftovers into partitions, sweeping their bounding box
+// bottom to top in strips one bin high
+void Partitioner::packLocalizedReminders(const std::vector<InstanceId>& leftovers, unsigned int fillThreshold,
+                                         std::vector<Partition>& out) const {
+    if (leftovers.empty()) return;
+    const InstanceTable& table = grid.getInstances();
 
-    std::unordered_set<Instance> reminders;
+    std::vector<char> reminders(table.size(), 0);
     float remMinY = std::numeric_limits<float>::max();
     float remMaxY = std::numeric_limits<float>::lowest();
     float remMinX = std::numeric_limits<float>::max();
     float remMaxX = std::numeric_limits<float>::lowest();
-
-    for (size_t iy = 0; iy < bestNy; ++iy) {
-        float bottom = minY + iy * binH;
-        float top = (iy == bestNy - 1) ? maxY : (bottom + binH);
-
-        float curX = minX;
-        while (curX < maxX) {
-            // Gather all unvisited instances in the current window
-            float right = (curX + binW > maxX) ? maxX : (curX + binW);
-            BoundingBox box(Point2D(curX, bottom), Point2D(right, top));
-            auto allInstances = grid.getCellInstancesWithin(box);
-
-
-            for (const auto& inst : allInstances) {
-                // Fill partition up to bitsizeLimit
-                if((current.totalBitsize + inst.getBitsize() <= bitsizeLimit)) {
-                    current.addInstance(inst);
-                    visited.insert(inst);
-                }
-                if(current.totalBitsize >= bitsizeLimit - grid.getMaxBitSize()) {
-                    partitions.push_back(current);
-                    current = Partition();
-                }
-            }
-            curX = right;
-        }
-        // After the inner X loop, push any remaining instances in 'current' to reminders
-        for (const auto& inst : current.instances) {
-            reminders.insert(inst);
-            if (inst.getY() < remMinY) remMinY = inst.getY();
-            if (inst.getY() > remMaxY) remMaxY = inst.getY();
-            if (inst.getX() < remMinX) remMinX = inst.getX();
-            if (inst.getX() > remMaxX) remMaxX = inst.getX();
-        }
-        current = Partition();
+    for (InstanceId id : leftovers) {
+        reminders[id] = 1;
+        float x = table.getX(id);
+        float y = table.getY(id);
+        if (y < remMinY) remMinY = y;
+        if (y > remMaxY) remMaxY = y;
+        if (x < remMinX) remMinX = x;
+        if (x > remMaxX) remMaxX = x;
     }
 
-    // If there are reminders, calculate their bounding box
-    if (!reminders.empty()) {
-        float gridStep = grid.getBinSize();
-        float curY = remMinY;
-        std::unordered_set<Instance> handled;
-
-        while (curY < remMaxY) {
-            float top = std::min(curY + gridStep, remMaxY);
-            BoundingBox box(Point2D(remMinX, curY), Point2D(remMaxX, top));
-            auto allInstances = grid.getCellInstancesWithin(box);
-
-            // Only consider reminders that haven't been handled yet
-            std::vector<Instance> unassigned;
-            for (const auto& inst : allInstances) {
-                if (reminders.count(inst) && handled.count(inst) == 0) {
-                    unassigned.push_back(inst);
-                }
-            }
-            
-            for (auto inst : unassigned) {
-                current.addInstance(inst);
-                handled.insert(inst);
-                if(current.totalBitsize >= bitsizeLimit - grid.getMaxBitSize()) {
-                    partitions.push_back(current);
-                    current = Partition();
-                }
+    float gridStep = grid.getBinSize();
+    float curY = remMinY;
+    Partition current(table);
+
+    // Runs at least once so reminders sharing a single y are not dropped
+    do {
+        float top = std::min(curY + gridStep, remMaxY);
+        BoundingBox box(Point2D(remMinX, curY), Point2D(remMaxX, top));
+
+        // Only consider reminders that haven't been handled yet
+        grid.forEachInstanceWithin(box, [&](InstanceId id) {
+            if (!reminders[id]) return;
+            current.addInstance(id);
+            reminders[id] = 0;
+            if(current.totalBitsize >= fillThreshold) {
+                out.push_back(std::move(current));
+                current = Partition(table);
             }
+        });
 
-            curY = top;
-        }
+        curY = top;
+    } while (curY < remMaxY);
 
-        if(!current.instances.empty()) {
-            partitions.push_back(current);
-            current = Partition();
-        }
+    if(!current.instances.empty()) {
+        out.push_back(std::move(current));
     }
 }
-
@@ -1,5 +1,8 @@
 #include "partitioner.hpp"
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <queue>
 
 void Partitioner::partitionMerging() {
     partitions.clear();
@@ -36,90 +39,132 @@ void Partitioner::partitionMerging() {
     float binW = width / bestNx;
     float binH = height / bestNy;
 
-    // Split the design into equal (by dimensions) partitions
+    const InstanceTable& table = grid.getInstances();
+
+    // Split the design into equal (by dimensions) partitions. Shared edges
+    // belong to the left / lower partition so no instance is taken twice.
     for (size_t ix = 0; ix < bestNx; ++ix) {
         for (size_t iy = 0; iy < bestNy; ++iy) {
             float left = minX + ix * binW;
-            float right = (ix == bestNx - 1) ? maxX : (left + binW);
+            float right = (ix == bestNx - 1) ? maxX : (minX + (ix + 1) * binW);
             float bottom = minY + iy * binH;
-            float top = (iy == bestNy - 1) ? maxY : (bottom + binH);
+            float top = (iy == bestNy - 1) ? maxY : (minY + (iy + 1) * binH);
 
             BoundingBox binBox(Point2D(left, bottom), Point2D(right, top));
-            auto instances = grid.getCellInstancesWithin(binBox);
 
-            Partition part;
+            Partition part(table);
             part.centerLoc.x = (left + right) / 2.0f;
             part.centerLoc.y = (bottom + top) / 2.0f;
-            for (const auto& inst : instances) {
-                part.addInstance(inst);
-            }
+            grid.forEachInstanceWithin(binBox, [&](InstanceId id) {
+                if (ix > 0 && table.getX(id) == left) return;
+                if (iy > 0 && table.getY(id) == bottom) return;
+                part.addInstance(id);
+            });
             // Always push the partition, even if empty
             partitions.push_back(std::move(part));
         }
     }
 
-    // Balancing step: move instances from overflowing to underflowing partitions
-    bool changed = true;
-    while (changed) {
-        changed = false;
-        // Find overflowing and underflowing partitions
-        std::vector<size_t> overIdx, underIdx;
-        for (size_t i = 0; i < partitions.size(); ++i) {
-            if (partitions[i].totalBitsize > bitsizeLimit)
-                overIdx.push_back(i);
-            else if (partitions[i].totalBitsize < bitsizeLimit - grid.getMaxBitSize())
-                underIdx.push_back(i);
-        }
-        if (overIdx.empty() || underIdx.empty()) break;
-
-        for (size_t oi : overIdx) {
-            auto& over = partitions[oi];
-            // Find the underflowing partition nearest to this one
-            size_t nearestUnder = underIdx[0];
-            float minDist = std::numeric_limits<float>::max();
-            for (size_t ui : underIdx) {
-                float d = std::hypot(
-                    over.centerLoc.x - partitions[ui].centerLoc.x,
-                    over.centerLoc.y - partitions[ui].centerLoc.y
-                );
-                if (d < minDist) {
-                    minDist = d;
-                    nearestUnder = ui;
-                }
+    // Balancing step: move instances from overflowing to underflowing partitions.
+    // Overflowing partitions sit in a max-heap keyed by their excess, entries
+    // are refreshed lazily. The nearest underflowing partition is found by a
+    // ring search on the (ix, iy) lattice the partitions were created on.
+    unsigned int underLimit = bitsizeLimit - grid.getMaxBitSize();
+    auto isUnder = [&](size_t i) { return partitions[i].totalBitsize < underLimit; };
+
+    size_t underCount = 0;
+    using HeapEntry = std::pair<unsigned int, size_t>; // excess, partition
+    std::priority_queue<HeapEntry> overHeap;
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        if (partitions[i].totalBitsize > bitsizeLimit)
+            overHeap.push({partitions[i].totalBitsize - bitsizeLimit, i});
+        else if (isUnder(i))
+            ++underCount;
+    }
+
+    auto nearestUnder = [&](size_t oi) {
+        const Point2D& center = partitions[oi].centerLoc;
+        long ox = long(oi / bestNy), oy = long(oi % bestNy);
+        long maxRing = long(std::max(bestNx, bestNy));
+        size_t best = partitions.size();
+        float minDist = std::numeric_limits<float>::max();
+        long foundRing = -1;
+        auto consider = [&](long ix, long iy) {
+            if (ix < 0 || iy < 0 || ix >= long(bestNx) || iy >= long(bestNy)) return;
+            size_t ui = size_t(ix) * bestNy + size_t(iy);
+            if (!isUnder(ui)) return;
+            // Like the first candidate fallback before, in case distances are not comparable
+            if (best == partitions.size()) best = ui;
+            float d = std::hypot(center.x - partitions[ui].centerLoc.x, center.y - partitions[ui].centerLoc.y);
+            if (d < minDist) {
+                minDist = d;
+                best = ui;
             }
-            auto& under = partitions[nearestUnder];
-            // Collect all instances in 'over' sorted by distance to 'under' center
-            std::vector<const Instance*> sortedByDist;
-            for (const auto& inst : over.instances) {
-                sortedByDist.push_back(&inst);
+        };
+        for (long r = 1; r <= maxRing; ++r) {
+            for (long ix = ox - r; ix <= ox + r; ++ix) {
+                consider(ix, oy - r);
+                consider(ix, oy + r);
             }
-            std::sort(sortedByDist.begin(), sortedByDist.end(),
-                [&under](const Instance* a, const Instance* b) {
-                    float da = std::hypot(a->getX() - under.centerLoc.x, a->getY() - under.centerLoc.y);
-                    float db = std::hypot(b->getX() - under.centerLoc.x, b->getY() - under.centerLoc.y);
-                    return da < db;
-                }
-            );
-
-            // Try to move the closest instance that fits
-            const Instance* bestInst = nullptr;
-            for (const Instance* inst : sortedByDist) {
-                if (under.totalBitsize + inst->getBitsize() <= bitsizeLimit) {
-                    bestInst = inst;
-                    break;
-                }
+            for (long iy = oy - r + 1; iy <= oy + r - 1; ++iy) {
+                consider(ox - r, iy);
+                consider(ox + r, iy);
             }
-            // Move the instance if it fits
-            if (bestInst && (under.totalBitsize + bestInst->getBitsize() <= bitsizeLimit)) {
-                under.addInstance(*bestInst);
-                over.removeInstance(*bestInst);
-                changed = true;
-                break; // Recompute overflowing/underflowing after each move
-            } else {
-                std::cout << "Could not move due to bit size limit" << std::endl;
+            // Centers drift while balancing, look one ring past the first hit
+            if (best != partitions.size()) {
+                if (foundRing < 0) foundRing = r;
+                else break;
             }
         }
-    }
-}
+        return best;
+    };
+
+    std::vector<std::pair<float, InstanceId>> candidates;  // squared distance, instance
+    while (!overHeap.empty() && underCount > 0) {
+        HeapEntry top = overHeap.top();
+        overHeap.pop();
+        size_t oi = top.second;
+        auto& over = partitions[oi];
+        if (over.totalBitsize <= bitsizeLimit || over.totalBitsize - bitsizeLimit != top.first) continue;
 
+        size_t ui = nearestUnder(oi);
+        if (ui == partitions.size()) break;
+        auto& under = partitions[ui];
 
+        // Move the instances closest to the underflowing partition, in one
+        // batch, until 'over' fits or 'under' is full. Only the front that
+        // moves is ordered: the excess in bits is enough when every instance
+        // fits, the sorted front doubles when some do not.
+        Point2D target = under.centerLoc;
+        candidates.clear();
+        for (InstanceId id : over.instances) {
+            float dx = table.getX(id) - target.x, dy = table.getY(id) - target.y;
+            candidates.emplace_back(dx * dx + dy * dy, id);
+        }
+        size_t sorted = 0;
+        size_t chunk = std::max(1u, top.first);
+        bool moved = false;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (over.totalBitsize <= bitsizeLimit || !isUnder(ui)) break;
+            if (i == sorted) {
+                sorted = std::min(candidates.size(), sorted + chunk);
+                std::partial_sort(candidates.begin() + i, candidates.begin() + sorted, candidates.end());
+                chunk *= 2;
+            }
+            InstanceId id = candidates[i].second;
+            if (under.totalBitsize + table.getBitsize(id) > bitsizeLimit) continue;
+            under.addInstance(id);
+            over.removeInstance(id);
+            moved = true;
+        }
+        if (!isUnder(ui)) --underCount;
+
+        if (!moved) {
+            std::cout << "Could not move due to bit size limit" << std::endl;
+            break;
+        }
+        if (over.totalBitsize > bitsizeLimit) {
+            overHeap.push({over.totalBitsize - bitsizeLimit, oi});
+        }
+    }
+}
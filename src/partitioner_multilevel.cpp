@@ -0,0 +1,408 @@
+#include "partitioner.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+// Level 0 cells hold about this many instances, so no bin size has to be chosen
+constexpr float instancesPerCell = 4.0f;
+// Coarsening stops at this many clusters per partition
+constexpr size_t coarsestClustersPerPartition = 16;
+// Refinement passes per level, the region grid shifts by half a region between passes
+constexpr int refinePasses = 4;
+// Region side in partition widths
+constexpr float regionWidthInPartitions = 4.0f;
+// Repair searches around a shed instance grow up to 16 partition widths
+constexpr int maxReachDoublings = 4;
+
+// Non-empty cells of one level as weighted clusters, in column-major cell order
+struct Level {
+    float cellSize = 0;
+    int nx = 0;
+    int ny = 0;
+    std::vector<std::uint32_t> cellCluster;  // dense over nx * ny cells, none when empty
+    std::vector<int> cx, cy;
+    std::vector<std::uint64_t> weight;       // bitsize sum
+    std::vector<std::uint32_t> count;
+    std::vector<double> sumX, sumY;
+    std::vector<std::uint32_t> parent;       // cluster of the next coarser level
+    std::vector<std::uint32_t> label;        // partition
+
+    size_t size() const { return weight.size(); }
+
+    std::uint32_t clusterAt(int x, int y) const {
+        if (x < 0 || x >= nx || y < 0 || y >= ny) return none;
+        return cellCluster[size_t(y) + size_t(x) * ny];
+    }
+
+    // Assigns cluster ids to the non-empty cells of cellCluster
+    void numberClusters() {
+        std::uint32_t next = 0;
+        for (int x = 0; x < nx; ++x) {
+            for (int y = 0; y < ny; ++y) {
+                std::uint32_t& cell = cellCluster[size_t(y) + size_t(x) * ny];
+                if (cell == none) continue;
+                cell = next++;
+                cx.push_back(x);
+                cy.push_back(y);
+            }
+        }
+        weight.assign(next, 0);
+        count.assign(next, 0);
+        sumX.assign(next, 0);
+        sumY.assign(next, 0);
+    }
+};
+
+float manhattan(double ax, double ay, const Point2D& b) {
+    return static_cast<float>(std::fabs(ax - b.x) + std::fabs(ay - b.y));
+}
+
+// Labels [first, last) with partitions [firstLabel, firstLabel + count),
+// splitting at the weighted median so both halves get weight in proportion
+// to their partition count
+void bisectClusters(Level& level, std::uint32_t* first, std::uint32_t* last, std::uint32_t firstLabel, size_t count) {
+    if (count == 1 || last - first <= 1) {
+        for (auto* it = first; it != last; ++it) level.label[*it] = firstLabel;
+        return;
+    }
+    int minX = std::numeric_limits<int>::max(), maxX = std::numeric_limits<int>::min();
+    int minY = minX, maxY = maxX;
+    std::uint64_t total = 0;
+    for (auto* it = first; it != last; ++it) {
+        minX = std::min(minX, level.cx[*it]);
+        maxX = std::max(maxX, level.cx[*it]);
+        minY = std::min(minY, level.cy[*it]);
+        maxY = std::max(maxY, level.cy[*it]);
+        total += level.weight[*it];
+    }
+    const std::vector<int>& axis = (maxX - minX >= maxY - minY) ? level.cx : level.cy;
+    const std::vector<int>& other = (maxX - minX >= maxY - minY) ? level.cy : level.cx;
+    std::sort(first, last, [&](std::uint32_t a, std::uint32_t b) {
+        return axis[a] < axis[b] || (axis[a] == axis[b] && (other[a] < other[b] || (other[a] == other[b] && a < b)));
+    });
+
+    size_t lowCount = count / 2;
+    double lowTarget = double(total) * lowCount / count;
+    std::uint32_t* split = first;
+    double prefix = 0;
+    while (split != last && prefix + level.weight[*split] / 2.0 < lowTarget) prefix += level.weight[*split++];
+    // Both halves keep at least one cluster
+    if (split == first) ++split;
+    if (split == last) --split;
+    bisectClusters(level, first, split, firstLabel, lowCount);
+    bisectClusters(level, split, last, firstLabel + std::uint32_t(lowCount), count - lowCount);
+}
+
+// Moves boundary clusters to neighbouring partitions whose centre is closer,
+// and out of partitions above the cap. Every pass freezes the partition
+// centres and gives each partition to the region holding its centre. Regions
+// run in parallel and only move clusters between partitions they own, so the
+// result does not depend on the thread count.
+void refineLevel(Level& level, const BoundingBox& bounds, size_t partitionCount, float partitionWidth,
+                 std::uint64_t cap, ThreadPool& pool) {
+    std::vector<std::uint64_t> partWeight(partitionCount);
+    std::vector<std::uint32_t> partClusters(partitionCount);
+    std::vector<Point2D> centers(partitionCount);
+    std::vector<std::uint32_t> regionOf(partitionCount);
+    float regionSize = std::max(partitionWidth * regionWidthInPartitions, level.cellSize);
+    int regionsX = static_cast<int>((bounds.ur.x - bounds.ll.x) / regionSize) + 2;
+    int regionsY = static_cast<int>((bounds.ur.y - bounds.ll.y) / regionSize) + 2;
+    size_t regionCount = size_t(regionsX) * regionsY;
+
+    for (int pass = 0; pass < refinePasses; ++pass) {
+        std::vector<std::uint32_t> snapshot = level.label;
+
+        std::fill(partWeight.begin(), partWeight.end(), 0);
+        std::fill(partClusters.begin(), partClusters.end(), 0);
+        std::vector<double> sumX(partitionCount, 0), sumY(partitionCount, 0);
+        std::vector<std::uint64_t> count(partitionCount, 0);
+        for (size_t c = 0; c < level.size(); ++c) {
+            std::uint32_t p = snapshot[c];
+            partWeight[p] += level.weight[c];
+            ++partClusters[p];
+            sumX[p] += level.sumX[c];
+            sumY[p] += level.sumY[c];
+            count[p] += level.count[c];
+        }
+
+        float offset = (pass % 2) ? regionSize / 2 : 0.0f;
+        std::vector<std::uint32_t> regionStart(regionCount + 1, 0);
+        for (size_t p = 0; p < partitionCount; ++p) {
+            if (count[p] == 0) {
+                regionOf[p] = none;
+                continue;
+            }
+            centers[p] = Point2D(float(sumX[p] / count[p]), float(sumY[p] / count[p]));
+            int rx = static_cast<int>((centers[p].x - bounds.ll.x + offset) / regionSize);
+            int ry = static_cast<int>((centers[p].y - bounds.ll.y + offset) / regionSize);
+            rx = std::min(std::max(rx, 0), regionsX - 1);
+            ry = std::min(std::max(ry, 0), regionsY - 1);
+            regionOf[p] = std::uint32_t(ry) + std::uint32_t(rx) * std::uint32_t(regionsY);
+            ++regionStart[regionOf[p] + 1];
+        }
+        for (size_t r = 0; r < regionCount; ++r) regionStart[r + 1] += regionStart[r];
+        std::vector<std::uint32_t> regionParts(regionStart.back());
+        {
+            std::vector<std::uint32_t> cursor(regionStart.begin(), regionStart.end() - 1);
+            for (size_t p = 0; p < partitionCount; ++p) {
+                if (regionOf[p] != none) regionParts[cursor[regionOf[p]]++] = std::uint32_t(p);
+            }
+        }
+
+        // Clusters grouped by partition, ascending
+        std::vector<std::uint32_t> partStart(partitionCount + 1, 0);
+        for (size_t c = 0; c < level.size(); ++c) ++partStart[snapshot[c] + 1];
+        for (size_t p = 0; p < partitionCount; ++p) partStart[p + 1] += partStart[p];
+        std::vector<std::uint32_t> clustersByPart(level.size());
+        {
+            std::vector<std::uint32_t> cursor(partStart.begin(), partStart.end() - 1);
+            for (size_t c = 0; c < level.size(); ++c) clustersByPart[cursor[snapshot[c]]++] = std::uint32_t(c);
+        }
+
+        pool.parallelFor(regionCount, [&](size_t r) {
+            std::uint32_t candidates[8];
+            for (std::uint32_t i = regionStart[r]; i < regionStart[r + 1]; ++i) {
+                std::uint32_t p = regionParts[i];
+                for (std::uint32_t j = partStart[p]; j < partStart[p + 1]; ++j) {
+                    std::uint32_t c = clustersByPart[j];
+                    if (level.label[c] != p) continue;
+
+                    int candidateCount = 0;
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        for (int dy = -1; dy <= 1; ++dy) {
+                            std::uint32_t n = level.clusterAt(level.cx[c] + dx, level.cy[c] + dy);
+                            if (n == none) continue;
+                            std::uint32_t b = snapshot[n];
+                            if (b == p || regionOf[b] != r) continue;
+                            if (std::find(candidates, candidates + candidateCount, b) == candidates + candidateCount) {
+                                candidates[candidateCount++] = b;
+                            }
+                        }
+                    }
+                    if (candidateCount == 0) continue;
+
+                    std::uint64_t w = level.weight[c];
+                    double x = level.sumX[c] / level.count[c];
+                    double y = level.sumY[c] / level.count[c];
+                    float here = manhattan(x, y, centers[p]);
+                    std::uint32_t best = none;
+                    float bestGain = std::numeric_limits<float>::lowest();
+                    for (int k = 0; k < candidateCount; ++k) {
+                        std::uint32_t b = candidates[k];
+                        if (partWeight[b] + w > cap) continue;
+                        float gain = here - manhattan(x, y, centers[b]);
+                        if (gain > bestGain) {
+                            bestGain = gain;
+                            best = b;
+                        }
+                    }
+                    bool over = partWeight[p] > cap;
+                    if (best == none || !(over || (bestGain > 0 && partClusters[p] > 1))) continue;
+
+                    level.label[c] = best;
+                    partWeight[p] -= w;
+                    partWeight[best] += w;
+                    --partClusters[p];
+                    ++partClusters[best];
+                }
+            }
+        });
+    }
+}
+
+}
+
+// Multilevel partitioning: instances are clustered on cells of about
+// instancesPerCell instances, cells are merged 2x2 up to a few clusters per
+// partition, the coarsest level is split by recursive bisection, and every
+// level on the way back down is refined in parallel regions.
+// Partitions still above the limit then shed their outermost instances.
+void Partitioner::partitionMultilevel() {
+    partitions.clear();
+    const InstanceTable& table = grid.getInstances();
+    size_t instanceCount = grid.getInstanceCount();
+    if (bitsizeLimit == 0 || instanceCount == 0) return;
+
+    const BoundingBox& bounds = grid.getBounds();
+    float width = bounds.ur.x - bounds.ll.x;
+    float height = bounds.ur.y - bounds.ll.y;
+    size_t totalBitSize = grid.getTotalBitSize();
+    size_t partitionCount = std::max<size_t>(1, ceil(float(totalBitSize) / (bitsizeLimit - grid.getMaxBitSize())));
+    // Designs on a line get partitions and cells along the longer side
+    bool flat = !(width > 0 && height > 0);
+    float partitionWidth = flat ? std::max(width, height) / partitionCount : std::sqrt(width * height / partitionCount);
+    float cellCount = std::max(1.0f, float(instanceCount) / instancesPerCell);
+    float cellSize = flat ? std::max(width, height) / cellCount : std::sqrt(width * height / cellCount);
+    if (!(cellSize > 0)) cellSize = 1.0f;
+    if (!(partitionWidth > 0)) partitionWidth = cellSize;
+    const int cellsX = static_cast<int>(width / cellSize) + 1;
+    const int cellsY = static_cast<int>(height / cellSize) + 1;
+    auto cellOf = [&](InstanceId id) {
+        int x = std::min(cellsX - 1, static_cast<int>((table.getX(id) - bounds.ll.x) / cellSize));
+        int y = std::min(cellsY - 1, static_cast<int>((table.getY(id) - bounds.ll.y) / cellSize));
+        return size_t(y) + size_t(x) * cellsY;
+    };
+
+    // Level 0: counting sort of the instances into cells. The level is filled
+    // before coarsening appends to levels.
+    std::vector<Level> levels(1);
+    InstanceRange binned = grid.getBinnedInstances();
+    std::vector<InstanceId> clusterInstances(binned.size());
+    std::vector<std::uint32_t> clusterStart;
+    {
+        Level& base = levels[0];
+        base.cellSize = cellSize;
+        base.nx = cellsX;
+        base.ny = cellsY;
+        base.cellCluster.assign(size_t(base.nx) * base.ny, none);
+        for (InstanceId id : binned) base.cellCluster[cellOf(id)] = 0;
+        base.numberClusters();
+        clusterStart.assign(base.size() + 1, 0);
+        for (InstanceId id : binned) ++clusterStart[base.cellCluster[cellOf(id)] + 1];
+        for (size_t c = 0; c < base.size(); ++c) clusterStart[c + 1] += clusterStart[c];
+        std::vector<std::uint32_t> cursor(clusterStart.begin(), clusterStart.end() - 1);
+        for (InstanceId id : binned) {
+            std::uint32_t c = base.cellCluster[cellOf(id)];
+            clusterInstances[cursor[c]++] = id;
+            base.weight[c] += table.getBitsize(id);
+            base.count[c] += 1;
+            base.sumX[c] += table.getX(id);
+            base.sumY[c] += table.getY(id);
+        }
+    }
+
+    // Coarsen 2x2 cells at a time
+    while (levels.back().size() > coarsestClustersPerPartition * partitionCount &&
+           (levels.back().nx > 1 || levels.back().ny > 1)) {
+        Level& fine = levels.back();
+        Level coarse;
+        coarse.cellSize = fine.cellSize * 2;
+        coarse.nx = (fine.nx + 1) / 2;
+        coarse.ny = (fine.ny + 1) / 2;
+        coarse.cellCluster.assign(size_t(coarse.nx) * coarse.ny, none);
+        for (size_t c = 0; c < fine.size(); ++c) {
+            coarse.cellCluster[size_t(fine.cy[c] / 2) + size_t(fine.cx[c] / 2) * coarse.ny] = 0;
+        }
+        coarse.numberClusters();
+        fine.parent.resize(fine.size());
+        for (size_t c = 0; c < fine.size(); ++c) {
+            std::uint32_t p = coarse.clusterAt(fine.cx[c] / 2, fine.cy[c] / 2);
+            fine.parent[c] = p;
+            coarse.weight[p] += fine.weight[c];
+            coarse.count[p] += fine.count[c];
+            coarse.sumX[p] += fine.sumX[c];
+            coarse.sumY[p] += fine.sumY[c];
+        }
+        levels.push_back(std::move(coarse));
+    }
+
+    // Coarsest level: recursive bisection of the clusters into partitions of
+    // equal weight, cutting across the longer side each time
+    Level& top = levels.back();
+    top.label.resize(top.size());
+    std::vector<std::uint32_t> order(top.size());
+    for (size_t c = 0; c < top.size(); ++c) order[c] = std::uint32_t(c);
+    bisectClusters(top, order.data(), order.data() + order.size(), 0, partitionCount);
+
+    // Uncoarsen and refine
+    ThreadPool pool(threadCount);
+    for (size_t l = levels.size(); l-- > 0;) {
+        Level& level = levels[l];
+        if (l + 1 < levels.size()) {
+            const Level& coarse = levels[l + 1];
+            level.label.resize(level.size());
+            for (size_t c = 0; c < level.size(); ++c) level.label[c] = coarse.label[level.parent[c]];
+        }
+        refineLevel(level, bounds, partitionCount, partitionWidth, bitsizeLimit, pool);
+    }
+
+    // Levels are complete, the finest one stays in place from here on
+    const Level& base = levels[0];
+    std::vector<std::vector<InstanceId>> members(partitionCount);
+    for (size_t c = 0; c < base.size(); ++c) {
+        auto& list = members[base.label[c]];
+        list.insert(list.end(), clusterInstances.begin() + clusterStart[c], clusterInstances.begin() + clusterStart[c + 1]);
+    }
+    for (const auto& list : members) {
+        Partition partition(table);
+        for (InstanceId id : list) partition.addInstance(id);
+        partitions.push_back(std::move(partition));
+    }
+
+    // Instance level repair: partitions above the limit shed their outermost
+    // instances. Each shed instance then joins the partition with room whose
+    // centre is closest, among the cells within about a partition width, and
+    // the few left without room are packed into new partitions in cell order.
+    std::vector<InstanceId> shed;
+    for (size_t p = 0; p < partitionCount; ++p) {
+        Partition& partition = partitions[p];
+        if (partition.totalBitsize <= bitsizeLimit) continue;
+        std::vector<InstanceId> ids = partition.instances;
+        Point2D center = partition.centerLoc;
+        std::sort(ids.begin(), ids.end(), [&](InstanceId a, InstanceId b) {
+            float da = manhattan(table.getX(a), table.getY(a), center);
+            float db = manhattan(table.getX(b), table.getY(b), center);
+            return da < db || (da == db && a < b);
+        });
+        unsigned int kept = 0;
+        size_t keep = 0;
+        while (keep < ids.size() && kept + table.getBitsize(ids[keep]) <= bitsizeLimit) kept += table.getBitsize(ids[keep++]);
+
+        Partition trimmed(table);
+        for (size_t i = 0; i < keep; ++i) trimmed.addInstance(ids[i]);
+        partition = std::move(trimmed);
+        shed.insert(shed.end(), ids.begin() + keep, ids.end());
+    }
+
+    // Searches that find no room are retried with twice the reach, as the
+    // neighbouring partitions are often all near the limit on designs along a line
+    int reach = std::max(1, static_cast<int>(std::ceil(partitionWidth / cellSize)));
+    std::vector<InstanceId> overflow;
+    for (int round = 0; round <= maxReachDoublings && !shed.empty(); ++round, reach *= 2) {
+        overflow.clear();
+        for (InstanceId id : shed) {
+            size_t cell = cellOf(id);
+            int x = static_cast<int>(cell / base.ny), y = static_cast<int>(cell % base.ny);
+            std::uint32_t best = none;
+            float bestDist = std::numeric_limits<float>::max();
+            for (int dx = -reach; dx <= reach; ++dx) {
+                for (int dy = -reach; dy <= reach; ++dy) {
+                    std::uint32_t n = base.clusterAt(x + dx, y + dy);
+                    if (n == none) continue;
+                    std::uint32_t b = base.label[n];
+                    if (partitions[b].totalBitsize + table.getBitsize(id) > bitsizeLimit) continue;
+                    float dist = manhattan(table.getX(id), table.getY(id), partitions[b].centerLoc);
+                    if (dist < bestDist || (dist == bestDist && b < best)) {
+                        bestDist = dist;
+                        best = b;
+                    }
+                }
+            }
+            if (best != none) partitions[best].addInstance(id);
+            else overflow.push_back(id);
+        }
+        shed.swap(overflow);
+    }
+    overflow.swap(shed);
+    std::sort(overflow.begin(), overflow.end(), [&](InstanceId a, InstanceId b) {
+        size_t ca = cellOf(a), cb = cellOf(b);
+        return ca < cb || (ca == cb && a < b);
+    });
+    Partition current(table);
+    for (InstanceId id : overflow) {
+        if (current.totalBitsize + table.getBitsize(id) > bitsizeLimit && !current.instances.empty()) {
+            partitions.push_back(std::move(current));
+            current = Partition(table);
+        }
+        current.addInstance(id);
+    }
+    if (!current.instances.empty()) partitions.push_back(std::move(current));
+
+    partitions.erase(std::remove_if(partitions.begin(), partitions.end(),
+                                    [](const Partition& partition) { return partition.instances.empty(); }),
+                     partitions.end());
+}
@@ -1,41 +1,154 @@
 #include "partitioner.hpp"
+#include <limits>
+
+namespace {
+
+// Unassigned instances binned on their own uniform grid, sized for a few
+// instances per bin whatever the grid bin size is. Each bin keeps its live
+// instances at the front of its slice so removal is a swap, and nearest
+// queries search rings of bins around the query point, stopping once no
+// further ring can hold a closer candidate.
+class NearestUnassigned {
+public:
+    explicit NearestUnassigned(const InstanceGrid& grid)
+        : table(grid.getInstances()), remaining(grid.getInstanceCount()) {
+        const BoundingBox& bounds = grid.getBounds();
+        float width = bounds.ur.x - bounds.ll.x;
+        float height = bounds.ur.y - bounds.ll.y;
+        constexpr float instancesPerBin = 4.0f;
+        float binCount = std::max(1.0f, float(remaining) / instancesPerBin);
+        // Designs on a line get bins along the longer side
+        if (width > 0.0f && height > 0.0f) binSize = std::sqrt(width * height / binCount);
+        else binSize = std::max(width, height) / binCount;
+        if (!(binSize > 0.0f)) binSize = 1.0f;
+        minX = bounds.ll.x;
+        minY = bounds.ll.y;
+        nx = cellOf(bounds.ur.x, minX) + 1;
+        ny = cellOf(bounds.ur.y, minY) + 1;
+
+        // Counting sort of all instances by bin
+        std::vector<std::uint32_t> binOf(table.size());
+        offsets.assign(size_t(nx) * ny + 1, 0);
+        for (InstanceId id = 0; id < table.size(); ++id) {
+            if (grid.isRemoved(id)) continue;
+            binOf[id] = binIndex(cellOf(table.getX(id), minX), cellOf(table.getY(id), minY));
+            ++offsets[binOf[id] + 1];
+        }
+        for (size_t i = 1; i < offsets.size(); ++i) offsets[i] += offsets[i - 1];
+        live.assign(offsets.size() - 1, 0);
+        ids.resize(offsets.back());
+        position.resize(table.size());
+        for (InstanceId id = 0; id < table.size(); ++id) {
+            if (grid.isRemoved(id)) continue;
+            std::uint32_t bin = binOf[id];
+            position[id] = offsets[bin] + live[bin]++;
+            ids[position[id]] = id;
+        }
+    }
+
+    bool empty() const { return remaining == 0; }
+
+    void remove(InstanceId id) {
+        std::uint32_t bin = binIndex(cellOf(table.getX(id), minX), cellOf(table.getY(id), minY));
+        std::uint32_t lastPos = offsets[bin] + --live[bin];
+        InstanceId moved = ids[lastPos];
+        ids[position[id]] = moved;
+        position[moved] = position[id];
+        ids[lastPos] = id;
+        position[id] = lastPos;
+        --remaining;
+    }
+
+    // Some unassigned instance, taken from the lowest non-empty bin
+    InstanceId first() {
+        while (live[cursor] == 0) ++cursor;
+        return ids[offsets[cursor]];
+    }
+
+    // Nearest unassigned instance to id by Manhattan distance
+    InstanceId nearest(InstanceId id) const {
+        int cx = cellOf(table.getX(id), minX);
+        int cy = cellOf(table.getY(id), minY);
+        int maxRing = std::max(std::max(cx, nx - 1 - cx), std::max(cy, ny - 1 - cy));
+
+        InstanceId best = id;
+        float minDist = std::numeric_limits<float>::max();
+        auto scanBin = [&](int ix, int iy) {
+            if (ix < 0 || ix >= nx || iy < 0 || iy >= ny) return;
+            std::uint32_t bin = binIndex(ix, iy);
+            for (std::uint32_t i = offsets[bin]; i < offsets[bin] + live[bin]; ++i) {
+                float dist = table.distance(id, ids[i]);
+                if (dist < minDist) {
+                    minDist = dist;
+                    best = ids[i];
+                }
+            }
+        };
+
+        for (int r = 0; r <= maxRing; ++r) {
+            if (r == 0) {
+                scanBin(cx, cy);
+            } else {
+                for (int ix = cx - r; ix <= cx + r; ++ix) {
+                    scanBin(ix, cy - r);
+                    scanBin(ix, cy + r);
+                }
+                for (int iy = cy - r + 1; iy <= cy + r - 1; ++iy) {
+                    scanBin(cx - r, iy);
+                    scanBin(cx + r, iy);
+                }
+            }
+            // Every bin of ring r + 1 is at least r bins away on one axis
+            if (best != id && minDist <= r * binSize) break;
+        }
+        return best;
+    }
+
+private:
+    int cellOf(float v, float origin) const { return static_cast<int>((v - origin) / binSize); }
+    std::uint32_t binIndex(int ix, int iy) const { return std::uint32_t(iy) + std::uint32_t(ix) * std::uint32_t(ny); }
+
+    const InstanceTable& table;
+    float binSize;
+    float minX;
+    float minY;
+    int nx;
+    int ny;
+    std::vector<InstanceId> ids;           // grouped by bin, live ones first
+    std::vector<std::uint32_t> position;   // index of each instance in ids
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> live;
+    size_t remaining;
+    size_t cursor = 0;
+};
+
+}
+
 void Partitioner::partitionNearby() {
     partitions.clear();
 
+    const InstanceTable& table = grid.getInstances();
+
     // Collect all instances and mark them as unassigned
-    std::unordered_set<const Instance*> unassigned;
-    for (const auto& cell : grid.getGrid()) {
-        for (const auto& inst : cell.second) {
-            unassigned.insert(&inst);
-        }
-    }
+    NearestUnassigned unassigned(grid);
 
     while (!unassigned.empty()) {
-        Partition current;
+        Partition current(table);
         // Start with any unassigned instance
-        const Instance* currentInst = *unassigned.begin();
-        current.addInstance(*currentInst);
-        unassigned.erase(currentInst);
+        InstanceId currentInst = unassigned.first();
+        current.addInstance(currentInst);
+        unassigned.remove(currentInst);
 
         while (current.totalBitsize < bitsizeLimit && !unassigned.empty()) {
             // Find the nearest unassigned instance to currentInst
-            const Instance* nearest = nullptr;
-            float minDist = std::numeric_limits<float>::max();
-            for (const Instance* cand : unassigned) {
-                float dist = currentInst->distanceTo(*cand);
-                if (dist < minDist) {
-                    minDist = dist;
-                    nearest = cand;
-                }
-            }
-            if (!nearest) break;
-            if (current.totalBitsize + nearest->getBitsize() > bitsizeLimit)
+            InstanceId nearest = unassigned.nearest(currentInst);
+            if (current.totalBitsize + table.getBitsize(nearest) > bitsizeLimit)
                 break;
-            current.addInstance(*nearest);
-            unassigned.erase(nearest);
+            current.addInstance(nearest);
+            unassigned.remove(nearest);
             currentInst = nearest;
         }
         if (!current.instances.empty())
             partitions.push_back(std::move(current));
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#include "partitioner.hpp"
+#include "instanceQuadtree.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+
+namespace {
+
+// Quadtree leaves hold about 1/leavesPerPartition of a partition
+constexpr unsigned int leavesPerPartition = 8;
+
+}
+
+// partitionLocalized on quadtree leaves instead of fixed bins: the row bands
+// are the same, but each band is swept leaf by leaf, so dense regions are
+// visited in small steps and sparse regions in large ones without a bin size
+// to choose. The band leftovers are packed along the leaf curve, so the grid
+// bin size does not enter the result either.
+void Partitioner::partitionQuadtree() {
+    partitions.clear();
+
+    BoundingBox bounds = grid.getBounds();
+    size_t bandCount = getLocalizedBandCount(bounds, grid.getTotalBitSize(), grid.getMaxBitSize(), bitsizeLimit);
+    if (bandCount == 0) return;
+
+    unsigned int fillThreshold = bitsizeLimit - grid.getMaxBitSize();
+    InstanceQuadtree tree(grid, fillThreshold / leavesPerPartition);
+
+    std::vector<std::vector<Partition>> bandPartitions(bandCount);
+    std::vector<std::vector<InstanceId>> bandLeftovers(bandCount);
+    ThreadPool pool(threadCount);
+    pool.parallelFor(bandCount, [&](size_t iy) {
+        sweepQuadtreeBand(tree, getLocalizedBand(bounds, bandCount, iy), iy == 0, fillThreshold,
+                          bandPartitions[iy], bandLeftovers[iy]);
+    });
+
+    std::vector<InstanceId> leftovers;
+    for (size_t iy = 0; iy < bandCount; ++iy) {
+        for (auto& partition : bandPartitions[iy]) {
+            partitions.push_back(std::move(partition));
+        }
+        leftovers.insert(leftovers.end(), bandLeftovers[iy].begin(), bandLeftovers[iy].end());
+    }
+
+    packQuadtreeReminders(tree, leftovers, fillThreshold, partitions);
+}
+
+// Visits the leaves touching the band left to right, bottom to top within a
+// column, and fills partitions with the band's part of each leaf. An instance
+// on the edge between two bands belongs to the lower one.
+void Partitioner::sweepQuadtreeBand(const InstanceQuadtree& tree, const BoundingBox& band, bool ownsBottomEdge,
+                                    unsigned int fillThreshold, std::vector<Partition>& out,
+                                    std::vector<InstanceId>& leftovers) const {
+    const InstanceTable& table = grid.getInstances();
+    const auto& leaves = tree.getLeaves();
+
+    std::vector<std::uint32_t> bandLeaves;
+    tree.forEachLeafWithin(band, [&](size_t leaf) { bandLeaves.push_back(static_cast<std::uint32_t>(leaf)); });
+    std::sort(bandLeaves.begin(), bandLeaves.end(), [&](std::uint32_t a, std::uint32_t b) {
+        const BoundingBox& boxA = leaves[a].box;
+        const BoundingBox& boxB = leaves[b].box;
+        if (boxA.ll.x != boxB.ll.x) return boxA.ll.x < boxB.ll.x;
+        if (boxA.ll.y != boxB.ll.y) return boxA.ll.y < boxB.ll.y;
+        return a < b;
+    });
+
+    Partition current(table);
+    for (std::uint32_t leaf : bandLeaves) {
+        for (InstanceId id : tree.getLeafInstances(leaf)) {
+            float y = table.getY(id);
+            if (y > band.ur.y || y < band.ll.y || (!ownsBottomEdge && y == band.ll.y)) continue;
+            current.addInstance(id);
+            if (current.totalBitsize >= fillThreshold) {
+                out.push_back(std::move(current));
+                current = Partition(table);
+            }
+        }
+    }
+    leftovers = std::move(current.instances);
+}
+
+// Packs the band leftovers into partitions in leaf order. Leaves are numbered
+// along a Hilbert curve, so consecutive leftovers stay close together.
+void Partitioner::packQuadtreeReminders(const InstanceQuadtree& tree, const std::vector<InstanceId>& leftovers,
+                                        unsigned int fillThreshold, std::vector<Partition>& out) const {
+    if (leftovers.empty()) return;
+    const InstanceTable& table = grid.getInstances();
+
+    std::vector<char> reminders(table.size(), 0);
+    for (InstanceId id : leftovers) reminders[id] = 1;
+
+    Partition current(table);
+    for (size_t leaf = 0; leaf < tree.getLeaves().size(); ++leaf) {
+        for (InstanceId id : tree.getLeafInstances(leaf)) {
+            if (!reminders[id]) continue;
+            current.addInstance(id);
+            if (current.totalBitsize >= fillThreshold) {
+                out.push_back(std::move(current));
+                current = Partition(table);
+            }
+        }
+    }
+    if (!current.instances.empty()) out.push_back(std::move(current));
+}
@@ -0,0 +1,295 @@
+#include "partitioner.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace {
+
+constexpr std::uint32_t noPartition = std::numeric_limits<std::uint32_t>::max();
+// A pair change has to shorten the routing by more than this fraction
+constexpr double minRelativeGain = 1e-6;
+// Halvings of the move list tried per pair before giving up on it
+constexpr size_t maxPrefixTries = 4;
+
+struct Candidate {
+    float gain;
+    InstanceId id;
+};
+
+// Instance locations sorted by x for nearest neighbour queries
+struct SortedPoints {
+    std::vector<float> x, y;
+
+    SortedPoints(const InstanceTable& table, const std::vector<InstanceId>& ids) {
+        std::vector<Point2D> points;
+        points.reserve(ids.size());
+        for (InstanceId id : ids) points.push_back(table.getLocation(id));
+        std::sort(points.begin(), points.end(), [](const Point2D& a, const Point2D& b) {
+            return a.x < b.x || (a.x == b.x && a.y < b.y);
+        });
+        for (const auto& point : points) {
+            x.push_back(point.x);
+            y.push_back(point.y);
+        }
+    }
+
+    // Manhattan distance to the nearest point, one point at the query itself is
+    // skipped when skipSelf is set
+    float nearest(float qx, float qy, bool skipSelf) const {
+        float best = std::numeric_limits<float>::max();
+        size_t start = std::lower_bound(x.begin(), x.end(), qx) - x.begin();
+        for (size_t k = start; k < x.size() && x[k] - qx < best; ++k) {
+            if (skipSelf && x[k] == qx && y[k] == qy) {
+                skipSelf = false;
+                continue;
+            }
+            best = std::min(best, x[k] - qx + std::fabs(y[k] - qy));
+        }
+        for (size_t k = start; k > 0 && qx - x[k - 1] < best; --k) {
+            best = std::min(best, qx - x[k - 1] + std::fabs(y[k - 1] - qy));
+        }
+        return best;
+    }
+};
+
+// Instances of from whose nearest neighbour in to is closer than the one in
+// from, best gain first
+std::vector<Candidate> getCandidates(const InstanceTable& table, const Partitioner::Partition& from,
+                                     const Partitioner::Partition& to, const SortedPoints& fromPoints,
+                                     const SortedPoints& toPoints) {
+    std::vector<Candidate> candidates;
+    const BoundingBox& box = to.getBoundingBox();
+    for (InstanceId id : from.instances) {
+        float x = table.getX(id), y = table.getY(id);
+        float own = fromPoints.nearest(x, y, true);
+        // Nothing in to can be nearer than its bounding box
+        float toBox = std::max(0.0f, std::max(box.ll.x - x, x - box.ur.x)) +
+                      std::max(0.0f, std::max(box.ll.y - y, y - box.ur.y));
+        if (toBox >= own) continue;
+        float gain = own - toPoints.nearest(x, y, false);
+        if (gain > 0) candidates.push_back({gain, id});
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.gain > b.gain || (a.gain == b.gain && a.id < b.id);
+    });
+    return candidates;
+}
+
+// Pairs of partitions with instances in the same or in side by side bins
+std::vector<std::pair<std::uint32_t, std::uint32_t>> getAdjacentPairs(const InstanceGrid& grid,
+                                                                      const std::vector<std::uint32_t>& partitionOf,
+                                                                      ThreadPool& pool) {
+    auto firstCell = grid.getFirstCell();
+    int nx = grid.getBinCountX(), ny = grid.getBinCountY();
+    auto binPartitions = [&](int ix, int iy, std::vector<std::uint32_t>& out) {
+        out.clear();
+        if (ix >= nx || iy >= ny) return;
+        for (InstanceId id : grid.getBinInstances(firstCell.first + ix, firstCell.second + iy)) {
+            std::uint32_t p = partitionOf[id];
+            if (p != noPartition) out.push_back(p);
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+
+    std::vector<std::vector<std::uint64_t>> columnPairs(nx);
+    pool.parallelFor(size_t(nx), [&](size_t ix) {
+        std::vector<std::uint32_t> here, right, up;
+        auto& pairs = columnPairs[ix];
+        for (int iy = 0; iy < ny; ++iy) {
+            binPartitions(int(ix), iy, here);
+            binPartitions(int(ix) + 1, iy, right);
+            binPartitions(int(ix), iy + 1, up);
+            for (size_t i = 0; i < here.size(); ++i) {
+                for (size_t j = i + 1; j < here.size(); ++j) pairs.push_back(std::uint64_t(here[i]) << 32 | here[j]);
+                for (const auto* other : {&right, &up}) {
+                    for (std::uint32_t q : *other) {
+                        if (q == here[i]) continue;
+                        std::uint32_t lo = std::min(here[i], q), hi = std::max(here[i], q);
+                        pairs.push_back(std::uint64_t(lo) << 32 | hi);
+                    }
+                }
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    });
+
+    std::vector<std::uint64_t> keys;
+    for (const auto& pairs : columnPairs) keys.insert(keys.end(), pairs.begin(), pairs.end());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs;
+    pairs.reserve(keys.size());
+    for (std::uint64_t key : keys) pairs.emplace_back(std::uint32_t(key >> 32), std::uint32_t(key));
+    return pairs;
+}
+
+// Splits the pairs into matchings, no partition appears twice in one of them
+std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>> colourPairs(
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs, size_t partitionCount) {
+    std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>> colours;
+    std::vector<size_t> usedInColour(partitionCount, std::numeric_limits<size_t>::max());
+    while (!pairs.empty()) {
+        size_t colour = colours.size();
+        colours.emplace_back();
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> rest;
+        for (const auto& pair : pairs) {
+            if (usedInColour[pair.first] == colour || usedInColour[pair.second] == colour) {
+                rest.push_back(pair);
+                continue;
+            }
+            usedInColour[pair.first] = usedInColour[pair.second] = colour;
+            colours.back().push_back(pair);
+        }
+        pairs.swap(rest);
+    }
+    return colours;
+}
+
+}
+
+// Every round finds the adjacent partition pairs, colours them into matchings
+// and refines the pairs of one matching in parallel. For a pair, instances
+// closer to the other centre move over, or swap with one coming back when
+// the other side is full. The pair keeps the result only when its nearest
+// neighbour routing length drops. Rounds repeat until nothing improves or
+// the budget is spent, which is checked before every pair.
+RefinementStats Partitioner::refinePartitions(double budgetSeconds) {
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(budgetSeconds));
+    RefinementStats stats;
+    const InstanceTable& table = grid.getInstances();
+
+    std::vector<std::uint32_t> partitionOf(table.size(), noPartition);
+    for (size_t p = 0; p < partitions.size(); ++p) {
+        for (InstanceId id : partitions[p].instances) partitionOf[id] = static_cast<std::uint32_t>(p);
+    }
+    ThreadPool pool(threadCount);
+    std::vector<double> lengths(partitions.size());
+    pool.parallelFor(partitions.size(), [&](size_t p) {
+        lengths[p] = measureNearestNeighbourLength(table, partitions[p].instances.data(), partitions[p].instances.size());
+    });
+    for (double length : lengths) stats.lengthBefore += length;
+
+    auto refinePair = [&](std::uint32_t ia, std::uint32_t ib) {
+        Partition& a = partitions[ia];
+        Partition& b = partitions[ib];
+        SortedPoints pointsA(table, a.instances), pointsB(table, b.instances);
+        std::vector<Candidate> fromA = getCandidates(table, a, b, pointsA, pointsB);
+        std::vector<Candidate> fromB = getCandidates(table, b, a, pointsB, pointsA);
+        if (fromA.empty() && fromB.empty()) return size_t(0);
+
+        // Moves in order of gain, a swap is two moves that only fit together
+        std::vector<std::pair<InstanceId, bool>> steps;  // instance, goes to b
+        std::vector<size_t> stepEnds;
+        unsigned int bitsA = a.totalBitsize, bitsB = b.totalBitsize;
+        size_t i = 0, j = 0;
+        while (i < fromA.size() || j < fromB.size()) {
+            bool takeA = j == fromB.size() || (i < fromA.size() && fromA[i].gain >= fromB[j].gain);
+            const Candidate& c = takeA ? fromA[i++] : fromB[j++];
+            unsigned int& own = takeA ? bitsA : bitsB;
+            unsigned int& other = takeA ? bitsB : bitsA;
+            unsigned int bitsize = table.getBitsize(c.id);
+            if (other + bitsize <= bitsizeLimit) {
+                steps.emplace_back(c.id, takeA);
+                stepEnds.push_back(steps.size());
+                own -= bitsize;
+                other += bitsize;
+                continue;
+            }
+            // Swap with the best remaining candidate of the full side
+            std::vector<Candidate>& back = takeA ? fromB : fromA;
+            size_t& k = takeA ? j : i;
+            if (k == back.size()) continue;
+            unsigned int backBits = table.getBitsize(back[k].id);
+            if (other - backBits + bitsize > bitsizeLimit || own - bitsize + backBits > bitsizeLimit) continue;
+            steps.emplace_back(c.id, takeA);
+            steps.emplace_back(back[k++].id, !takeA);
+            stepEnds.push_back(steps.size());
+            own += backBits - bitsize;
+            other += bitsize - backBits;
+        }
+        if (steps.empty()) return size_t(0);
+
+        // All the moves first, then shorter runs of the best ones
+        double before = lengths[ia] + lengths[ib];
+        std::vector<InstanceId> idsA, idsB;
+        for (size_t tries = 0, ends = stepEnds.size(); tries < maxPrefixTries && ends > 0; ++tries, ends /= 2) {
+            size_t count = stepEnds[ends - 1];
+            std::vector<InstanceId> toA, toB;
+            for (size_t s = 0; s < count; ++s) (steps[s].second ? toB : toA).push_back(steps[s].first);
+            std::sort(toA.begin(), toA.end());
+            std::sort(toB.begin(), toB.end());
+            idsA.clear();
+            idsB.clear();
+            for (InstanceId id : a.instances) {
+                if (!std::binary_search(toB.begin(), toB.end(), id)) idsA.push_back(id);
+            }
+            for (InstanceId id : b.instances) {
+                if (!std::binary_search(toA.begin(), toA.end(), id)) idsB.push_back(id);
+            }
+            idsA.insert(idsA.end(), toA.begin(), toA.end());
+            idsB.insert(idsB.end(), toB.begin(), toB.end());
+            double lengthA = measureNearestNeighbourLength(table, idsA.data(), idsA.size());
+            double lengthB = measureNearestNeighbourLength(table, idsB.data(), idsB.size());
+            if (lengthA + lengthB >= before * (1 - minRelativeGain)) continue;
+
+            a = Partition(table);
+            b = Partition(table);
+            for (InstanceId id : idsA) a.addInstance(id);
+            for (InstanceId id : idsB) b.addInstance(id);
+            for (InstanceId id : toA) partitionOf[id] = ia;
+            for (InstanceId id : toB) partitionOf[id] = ib;
+            lengths[ia] = lengthA;
+            lengths[ib] = lengthB;
+            return count;
+        }
+        return size_t(0);
+    };
+
+    // Only pairs with a partition that changed in the previous round can improve
+    std::vector<char> changed(partitions.size(), 1), changedNext(partitions.size(), 0);
+    bool improved = true;
+    while (improved && clock::now() < deadline) {
+        improved = false;
+        ++stats.rounds;
+        auto colours = colourPairs(getAdjacentPairs(grid, partitionOf, pool), partitions.size());
+        for (const auto& matching : colours) {
+            if (clock::now() >= deadline) {
+                stats.budgetExhausted = true;
+                break;
+            }
+            std::vector<size_t> moved(matching.size());
+            std::vector<char> tried(matching.size());
+            pool.parallelFor(matching.size(), [&](size_t m) {
+                std::uint32_t ia = matching[m].first, ib = matching[m].second;
+                tried[m] = (changed[ia] || changed[ib]) && clock::now() < deadline;
+                if (tried[m]) moved[m] = refinePair(ia, ib);
+                if (moved[m]) changedNext[ia] = changedNext[ib] = 1;
+            });
+            for (size_t m = 0; m < matching.size(); ++m) {
+                // Skipped for the deadline, not for lack of change
+                if (!tried[m] && (changed[matching[m].first] || changed[matching[m].second])) {
+                    stats.budgetExhausted = true;
+                }
+                stats.pairsTried += tried[m];
+                size_t count = moved[m];
+                if (count == 0) continue;
+                ++stats.pairsImproved;
+                stats.movedInstances += count;
+                improved = true;
+            }
+        }
+        changed.swap(changedNext);
+        std::fill(changedNext.begin(), changedNext.end(), 0);
+    }
+    // The last round improved, so the next one was cut by the deadline
+    if (improved && clock::now() >= deadline) stats.budgetExhausted = true;
+
+    for (double length : lengths) stats.lengthAfter += length;
+    return stats;
+}
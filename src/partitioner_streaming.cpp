@@ -0,0 +1,297 @@
+#include "partitioner.hpp"
+#include "instanceFile.hpp"
+#include "mappedFile.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unistd.h>
+
+namespace {
+
+// Largest number of spill files open at once while bucketing
+constexpr size_t maxSpillFiles = 256;
+// Bands resident at once unless the caller sets it
+constexpr size_t defaultWindowBands = 8;
+constexpr size_t spillBufferBytes = 1 << 18;
+
+// Calls fn(index, name, x, y, bitsize) for every instance of a text or binary
+// instance file in file order. Returns false when the file cannot be read.
+template<typename Fn>
+bool forEachFileInstance(const std::string& filename, Fn&& fn) {
+    MappedFile file(filename);
+    if (!file.data) return false;
+
+    InstanceFileHeader h;
+    if (!readInstanceFileHeader(filename, h)) {
+        std::uint64_t index = 0;
+        const char* p = file.data;
+        const char* end = file.data + file.size;
+        while (p != end) {
+            std::string_view name;
+            float x, y;
+            unsigned int bitsize;
+            bool ok;
+            p = parseInstanceLine(p, end, name, x, y, bitsize, ok);
+            if (ok) fn(index++, name, x, y, bitsize);
+        }
+        return true;
+    }
+
+    const float* xs = reinterpret_cast<const float*>(file.data + h.xOffset);
+    const float* ys = reinterpret_cast<const float*>(file.data + h.yOffset);
+    const std::uint32_t* bitsizes = reinterpret_cast<const std::uint32_t*>(file.data + h.bitsizeOffset);
+    const std::uint32_t* nameIndex = reinterpret_cast<const std::uint32_t*>(file.data + h.nameIndexOffset);
+    const std::uint64_t* nameOffsets = reinterpret_cast<const std::uint64_t*>(file.data + h.nameOffsetsOffset);
+    const char* names = file.data + h.namesOffset;
+    for (std::uint64_t i = 0; i < h.count; ++i) {
+        std::uint32_t n = nameIndex[i];
+        if (n >= h.nameCount || nameOffsets[n] > nameOffsets[n + 1] || nameOffsets[n + 1] > h.nameBytes) return false;
+        fn(i, std::string_view(names + nameOffsets[n], nameOffsets[n + 1] - nameOffsets[n]), xs[i], ys[i], bitsizes[i]);
+    }
+    return true;
+}
+
+// Spill record: uint64 index, float x, float y, uint32 bitsize, uint32 band,
+// uint32 nameLength, then the name bytes
+struct SpillRecord {
+    std::uint64_t index;
+    float x;
+    float y;
+    std::uint32_t bitsize;
+    std::uint32_t band;
+    std::string_view name;
+};
+
+constexpr size_t spillRecordBytes = sizeof(std::uint64_t) + 5 * sizeof(std::uint32_t);
+
+void appendSpillRecord(std::string& buffer, const SpillRecord& r) {
+    std::uint32_t nameLength = static_cast<std::uint32_t>(r.name.size());
+    char fixed[spillRecordBytes];
+    std::memcpy(fixed, &r.index, 8);
+    std::memcpy(fixed + 8, &r.x, 4);
+    std::memcpy(fixed + 12, &r.y, 4);
+    std::memcpy(fixed + 16, &r.bitsize, 4);
+    std::memcpy(fixed + 20, &r.band, 4);
+    std::memcpy(fixed + 24, &nameLength, 4);
+    buffer.append(fixed, spillRecordBytes);
+    buffer.append(r.name.data(), r.name.size());
+}
+
+// Calls fn(SpillRecord) for every record in [p, end), false on a truncated file
+template<typename Fn>
+bool forEachSpillRecord(const char* p, const char* end, Fn&& fn) {
+    while (p != end) {
+        if (size_t(end - p) < spillRecordBytes) return false;
+        SpillRecord r;
+        std::uint32_t nameLength;
+        std::memcpy(&r.index, p, 8);
+        std::memcpy(&r.x, p + 8, 4);
+        std::memcpy(&r.y, p + 12, 4);
+        std::memcpy(&r.bitsize, p + 16, 4);
+        std::memcpy(&r.band, p + 20, 4);
+        std::memcpy(&nameLength, p + 24, 4);
+        p += spillRecordBytes;
+        if (size_t(end - p) < nameLength) return false;
+        r.name = std::string_view(p, nameLength);
+        p += nameLength;
+        fn(r);
+    }
+    return true;
+}
+
+// An instance kept in memory between bands
+struct CarriedInstance {
+    std::uint64_t index;
+    float x;
+    float y;
+    unsigned int bitsize;
+    std::string name;
+};
+
+}
+
+StreamingPartitionStats Partitioner::partitionLocalizedStreaming(const std::string& input, const std::string& output,
+                                                                 float binSize, unsigned int bitsizeLimit,
+                                                                 const std::string& spillDir, size_t threadCount,
+                                                                 size_t windowBands) {
+    StreamingPartitionStats stats;
+    threadCount = std::max<size_t>(1, threadCount);
+
+    // Pass 1: bounds and totals, from the coordinate and bitsize columns for
+    // binary files; the header values are not trusted
+    BoundingBox bounds(0, 0, 0, 0);
+    size_t totalBitSize = 0;
+    unsigned int maxBitSize = 0;
+    InstanceFileHeader header;
+    if (readInstanceFileHeader(input, header)) {
+        if (!readInstanceFileSummary(input, header)) return stats;
+        stats.instanceCount = header.count;
+        bounds = BoundingBox(header.minX, header.minY, header.maxX, header.maxY);
+        totalBitSize = header.totalBitSize;
+        maxBitSize = header.maxBitSize;
+    } else {
+        bool read = forEachFileInstance(input, [&](std::uint64_t, std::string_view, float x, float y, unsigned int bitsize) {
+            if (stats.instanceCount++ == 0) {
+                bounds = BoundingBox(x, y, x, y);
+            } else {
+                bounds.ll.x = std::min(bounds.ll.x, x);
+                bounds.ll.y = std::min(bounds.ll.y, y);
+                bounds.ur.x = std::max(bounds.ur.x, x);
+                bounds.ur.y = std::max(bounds.ur.y, y);
+            }
+            maxBitSize = std::max(maxBitSize, bitsize);
+            totalBitSize += bitsize;
+        });
+        if (!read) return stats;
+    }
+
+    std::ofstream out(output);
+    if (!out) return stats;
+    size_t bandCount = stats.instanceCount == 0 ? 0
+                     : getLocalizedBandCount(bounds, totalBitSize, maxBitSize, bitsizeLimit);
+    if (bandCount == 0) {
+        stats.ok = true;
+        return stats;
+    }
+
+    // A window is a run of bands swept together, one spill file each. Its size
+    // bounds the memory, whatever the thread count.
+    if (windowBands == 0) windowBands = defaultWindowBands;
+    size_t bandsPerWindow = std::max(windowBands, (bandCount + maxSpillFiles - 1) / maxSpillFiles);
+    size_t windowCount = (bandCount + bandsPerWindow - 1) / bandsPerWindow;
+    stats.bandCount = bandCount;
+    stats.windowCount = windowCount;
+    stats.bandsPerWindow = bandsPerWindow;
+
+    std::vector<float> bandTops(bandCount);
+    for (size_t band = 0; band < bandCount; ++band) {
+        bandTops[band] = getLocalizedBand(bounds, bandCount, band).ur.y;
+    }
+    float bandHeight = (bounds.ur.y - bounds.ll.y) / bandCount;
+    // An instance on a shared edge belongs to the lower band, the one that
+    // visits it first in the in-memory sweep
+    auto ownerBand = [&](float y) {
+        size_t band = 0;
+        if (bandHeight > 0) {
+            float estimate = std::floor((y - bounds.ll.y) / bandHeight);
+            band = static_cast<size_t>(std::min<float>(std::max(estimate, 0.0f), float(bandCount - 1)));
+        }
+        while (band > 0 && y <= bandTops[band - 1]) --band;
+        while (band + 1 < bandCount && y > bandTops[band]) ++band;
+        return band;
+    };
+
+    // Pass 2: bucket the instances into window spill files, in file order.
+    // The names are unique per call, concurrent calls may share spillDir.
+    static std::atomic<unsigned int> callCount(0);
+    std::string spillPrefix = spillDir + "/partitioner_spill_" + std::to_string(::getpid()) + "_" +
+                              std::to_string(callCount++) + "_";
+    auto spillName = [&](size_t window) { return spillPrefix + std::to_string(window) + ".bin"; };
+    auto removeSpills = [&]() {
+        for (size_t window = 0; window < windowCount; ++window) std::remove(spillName(window).c_str());
+    };
+    {
+        std::vector<std::ofstream> spills(windowCount);
+        std::vector<std::string> buffers(windowCount);
+        bool spilled = true;
+        for (size_t window = 0; window < windowCount; ++window) {
+            spills[window].open(spillName(window), std::ios::binary | std::ios::trunc);
+            spilled = spilled && spills[window];
+        }
+        bool read = spilled && forEachFileInstance(input, [&](std::uint64_t index, std::string_view name,
+                                                              float x, float y, unsigned int bitsize) {
+            size_t band = ownerBand(y);
+            size_t window = band / bandsPerWindow;
+            appendSpillRecord(buffers[window], {index, x, y, bitsize, std::uint32_t(band), name});
+            if (buffers[window].size() >= spillBufferBytes) {
+                spills[window].write(buffers[window].data(), buffers[window].size());
+                buffers[window].clear();
+            }
+        });
+        for (size_t window = 0; window < windowCount && spilled; ++window) {
+            spills[window].write(buffers[window].data(), buffers[window].size());
+            spills[window].close();
+            spilled = static_cast<bool>(spills[window]);
+        }
+        if (!read || !spilled) {
+            removeSpills();
+            return stats;
+        }
+    }
+
+    // Pass 3: sweep the bands of one window at a time and write their partitions
+    unsigned int fillThreshold = bitsizeLimit - maxBitSize;
+    std::vector<CarriedInstance> carried;
+    size_t partitionIndex = 0;
+    auto writePartition = [&](const Partition& partition, const InstanceTable& table) {
+        for (InstanceId id : partition.instances) out << table.getName(id) << ' ' << partitionIndex << '\n';
+        if (partition.totalBitsize > bitsizeLimit) ++stats.overLimitPartitions;
+        ++partitionIndex;
+    };
+
+    ThreadPool pool(threadCount);
+    for (size_t window = 0; window < windowCount; ++window) {
+        size_t firstBand = window * bandsPerWindow;
+        size_t windowBands = std::min(bandsPerWindow, bandCount - firstBand);
+
+        std::vector<InstanceGrid> bandGrids(windowBands, InstanceGrid(binSize));
+        std::vector<std::vector<std::uint64_t>> bandIndices(windowBands);
+        size_t resident = 0;
+        bool loaded;
+        {
+            MappedFile spill(spillName(window));
+            loaded = spill.size == 0 || (spill.data && forEachSpillRecord(spill.data, spill.data + spill.size, [&](const SpillRecord& r) {
+                size_t local = r.band - firstBand;
+                bandGrids[local].addInstance(r.name, r.x, r.y, r.bitsize);
+                bandIndices[local].push_back(r.index);
+                ++resident;
+            }));
+        }
+        std::remove(spillName(window).c_str());
+        if (!loaded) {
+            removeSpills();
+            return stats;
+        }
+        stats.peakResidentInstances = std::max(stats.peakResidentInstances, resident + carried.size());
+
+        std::vector<std::vector<Partition>> bandPartitions(windowBands);
+        std::vector<std::vector<InstanceId>> bandLeftovers(windowBands);
+        pool.parallelFor(windowBands, [&](size_t local) {
+            size_t band = firstBand + local;
+            Partitioner bandPartitioner(bandGrids[local], bitsizeLimit);
+            bandPartitioner.sweepLocalizedBand(getLocalizedBand(bounds, bandCount, band), band == 0, fillThreshold,
+                                               bandPartitions[local], bandLeftovers[local]);
+        });
+
+        for (size_t local = 0; local < windowBands; ++local) {
+            const InstanceTable& table = bandGrids[local].getInstances();
+            for (const auto& partition : bandPartitions[local]) writePartition(partition, table);
+            for (InstanceId id : bandLeftovers[local]) {
+                carried.push_back({bandIndices[local][id], table.getX(id), table.getY(id), table.getBitsize(id),
+                                   std::string(table.getName(id))});
+            }
+        }
+    }
+
+    // The leftovers in input order, as the in-memory grid holds them
+    std::sort(carried.begin(), carried.end(),
+              [](const CarriedInstance& a, const CarriedInstance& b) { return a.index < b.index; });
+    InstanceGrid reminderGrid(binSize);
+    std::vector<InstanceId> reminders;
+    reminders.reserve(carried.size());
+    for (const auto& instance : carried) {
+        reminders.push_back(reminderGrid.addInstance(instance.name, instance.x, instance.y, instance.bitsize));
+    }
+    std::vector<Partition> reminderPartitions;
+    Partitioner(reminderGrid, bitsizeLimit).packLocalizedReminders(reminders, fillThreshold, reminderPartitions);
+    for (const auto& partition : reminderPartitions) writePartition(partition, reminderGrid.getInstances());
+
+    stats.partitionCount = partitionIndex;
+    stats.ok = static_cast<bool>(out);
+    return stats;
+}
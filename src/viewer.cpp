@@ -1,72 +1,311 @@
 #include "viewer.hpp"
+#include "parallel.hpp"
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
-// Modified DotWidget to take a vector of sets and draw each set in a different color
-DotWidget::DotWidget(InstanceGrid & grid, std::vector<Partitioner::Partition> partitions, QWidget* parent)
-    : QWidget(parent), partitions(std::move(partitions)), grid(grid) {}
+namespace {
 
-void DotWidget::paintEvent(QPaintEvent*) {
-    QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
+constexpr std::uint32_t noPartition = std::numeric_limits<std::uint32_t>::max();
+// Finest raster edge in pixels, coarser levels halve it down to minPyramidSize
+constexpr int maxPyramidSize = 4096;
+constexpr int minPyramidSize = 256;
+constexpr int tileRows = 64;
+// Below this on-screen partition size (pixels) partitions are drawn as hulls
+constexpr float hullModeExtent = 16.0f;
+// Up to this many visible instances they are drawn one by one
+constexpr float directDrawLimit = 50000.0f;
 
-    // Color palette for up to 10 partitions, will repeat if more
-    static const QColor colors[] = {
-        Qt::red, Qt::blue, Qt::green, Qt::magenta, Qt::darkYellow,
-        Qt::cyan, Qt::darkRed, Qt::darkGreen, Qt::darkBlue, Qt::black
-    };
-    constexpr int colorCount = sizeof(colors) / sizeof(colors[0]);
+// Color palette for up to 10 partitions, will repeat if more
+const QColor colors[] = {
+    Qt::red, Qt::blue, Qt::green, Qt::magenta, Qt::darkYellow,
+    Qt::cyan, Qt::darkRed, Qt::darkGreen, Qt::darkBlue, Qt::black
+};
+constexpr int colorCount = sizeof(colors) / sizeof(colors[0]);
 
-    
-    // Find min/max for scaling
-    float minX = grid.getBounds().ll.x;
-    float maxX = grid.getBounds().ur.x;
-    float minY = grid.getBounds().ll.y;
-    float maxY = grid.getBounds().ur.y;
+QColor partitionColor(std::uint32_t partition) {
+    return partition == noPartition ? QColor(Qt::white) : colors[partition % colorCount];
+}
 
-    float dataWidth = maxX - minX;
-    float dataHeight = maxY - minY;
+float cross(const Point2D& o, const Point2D& a, const Point2D& b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
 
-    float widgetWidth = width() - 20;
-    float widgetHeight = height() - 20;
+// Andrew's monotone chain
+std::vector<Point2D> convexHull(std::vector<Point2D> points) {
+    std::sort(points.begin(), points.end(), [](const Point2D& a, const Point2D& b) {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+    if (points.size() < 3) return points;
+    std::vector<Point2D> hull(points.size() * 2);
+    size_t k = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0) --k;
+        hull[k++] = points[i];
+    }
+    for (size_t i = points.size() - 1, lower = k + 1; i > 0; --i) {
+        while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i - 1]) <= 0) --k;
+        hull[k++] = points[i - 1];
+    }
+    hull.resize(k - 1);
+    return hull;
+}
 
-    // Keep aspect ratio
-    float scale = 1.0f;
-    if (dataWidth > 0 && dataHeight > 0) {
-        float scaleX = widgetWidth / dataWidth;
-        float scaleY = widgetHeight / dataHeight;
-        scale = std::min(scaleX, scaleY);
+}
+
+DotWidget::DotWidget(const InstanceGrid& grid, const std::vector<Partitioner::Partition>& partitions,
+                     size_t threadCount, QWidget* parent)
+    : QWidget(parent), grid(grid), partitions(partitions), bounds(grid.getBounds()), pool(threadCount) {
+    viewCenter = QPointF((bounds.ll.x + bounds.ur.x) / 2, (bounds.ll.y + bounds.ur.y) / 2);
+    buildPartitionIndex();
+    buildRasterPyramid();
+    buildHulls();
+}
+
+// The only walk over the partition instance lists
+void DotWidget::buildPartitionIndex() {
+    partitionOf.assign(grid.getInstances().size(), noPartition);
+    for (size_t p = 0; p < partitions.size(); ++p) {
+        for (InstanceId id : partitions[p].instances) partitionOf[id] = static_cast<std::uint32_t>(p);
     }
+}
 
-    // Centering offsets
-    float offsetX = 10 + (widgetWidth - scale * dataWidth) / 2.0f;
-    float offsetY = 10 + (widgetHeight - scale * dataHeight) / 2.0f;
-
-    for (const auto& vect : grid.getGrid()) {
-        for (auto inst : vect.second) {
-            painter.setPen(Qt::white);
-            painter.setBrush(Qt::white);
-            int px = static_cast<int>(offsetX + (inst.getX() - minX) * scale);
-            int py = static_cast<int>(offsetY + (inst.getY() - minY) * scale);
-            painter.drawEllipse(QPoint(px, py), 2, 2);
-        }
+// Rasterises every instance into level 0 in parallel row tiles, each tile
+// only visiting the grid bins under it, then halves down to the coarse levels
+void DotWidget::buildRasterPyramid() {
+    float dataWidth = bounds.ur.x - bounds.ll.x;
+    float dataHeight = bounds.ur.y - bounds.ll.y;
+    float extent = std::max(dataWidth, dataHeight);
+    if (!(extent > 0) || grid.getInstances().size() == 0) return;
+
+    pyramidScale = maxPyramidSize / extent;
+    int width = std::max(1, static_cast<int>(std::ceil(dataWidth * pyramidScale)));
+    int height = std::max(1, static_cast<int>(std::ceil(dataHeight * pyramidScale)));
+
+    QImage level(width, height, QImage::Format_ARGB32_Premultiplied);
+    level.fill(Qt::transparent);
+    uchar* bits = level.bits();
+    qsizetype bytesPerLine = level.bytesPerLine();
+    const InstanceTable& table = grid.getInstances();
+
+    size_t tileCount = (height + tileRows - 1) / tileRows;
+    pool.parallelFor(tileCount, [&](size_t tile) {
+        int firstRow = static_cast<int>(tile) * tileRows;
+        int lastRow = std::min(height, firstRow + tileRows);
+        BoundingBox box(bounds.ll.x, bounds.ll.y + firstRow / pyramidScale,
+                        bounds.ur.x, bounds.ll.y + lastRow / pyramidScale);
+        grid.forEachInstanceWithin(box, [&](InstanceId id) {
+            int row = std::min(height - 1, static_cast<int>((table.getY(id) - bounds.ll.y) * pyramidScale));
+            if (row < firstRow || row >= lastRow) return;
+            int col = std::min(width - 1, static_cast<int>((table.getX(id) - bounds.ll.x) * pyramidScale));
+            QRgb* line = reinterpret_cast<QRgb*>(bits + row * bytesPerLine);
+            // Partitioned instances win over unassigned ones
+            if (line[col] == 0 || partitionOf[id] != noPartition) line[col] = partitionColor(partitionOf[id]).rgba();
+        });
+    });
+    pyramid.push_back(level);
+
+    // Each coarser pixel takes the first coloured pixel of its 2x2 block
+    while (std::max(pyramid.back().width(), pyramid.back().height()) > minPyramidSize) {
+        const QImage& fine = pyramid.back();
+        QImage coarse((fine.width() + 1) / 2, (fine.height() + 1) / 2, QImage::Format_ARGB32_Premultiplied);
+        const uchar* fineBits = fine.constBits();
+        qsizetype fineStride = fine.bytesPerLine();
+        uchar* coarseBits = coarse.bits();
+        qsizetype coarseStride = coarse.bytesPerLine();
+        int fineWidth = fine.width(), fineHeight = fine.height();
+        pool.parallelFor(coarse.height(), [&](size_t y) {
+            QRgb* out = reinterpret_cast<QRgb*>(coarseBits + y * coarseStride);
+            for (int x = 0; x < coarse.width(); ++x) {
+                QRgb value = 0;
+                for (int dy = 0; dy < 2 && !value; ++dy) {
+                    int fy = static_cast<int>(y) * 2 + dy;
+                    if (fy >= fineHeight) break;
+                    const QRgb* in = reinterpret_cast<const QRgb*>(fineBits + fy * fineStride);
+                    for (int dx = 0; dx < 2 && !value; ++dx) {
+                        if (x * 2 + dx < fineWidth) value = in[x * 2 + dx];
+                    }
+                }
+                out[x] = value;
+            }
+        });
+        pyramid.push_back(coarse);
     }
+}
 
-    // Draw each partition in a different color
-    size_t idx = 0;
-    for (const auto& set : partitions) {
-        painter.setPen(colors[idx % colorCount]);
-        painter.setBrush(colors[idx % colorCount]);
-        for (const auto& inst : set.instances) {
-            int px = static_cast<int>(offsetX + (inst.getX() - minX) * scale);
-            int py = static_cast<int>(offsetY + (inst.getY() - minY) * scale);
-            painter.drawEllipse(QPoint(px, py), 2, 2);
-        }
-        ++idx;
+void DotWidget::buildHulls() {
+    std::vector<std::vector<Point2D>> points(partitions.size());
+    const InstanceTable& table = grid.getInstances();
+    pool.parallelFor(partitions.size(), [&](size_t p) {
+        std::vector<Point2D> locations;
+        locations.reserve(partitions[p].instances.size());
+        for (InstanceId id : partitions[p].instances) locations.push_back(table.getLocation(id));
+        points[p] = convexHull(std::move(locations));
+    });
+
+    hulls.resize(partitions.size());
+    for (size_t p = 0; p < partitions.size(); ++p) {
+        for (const Point2D& point : points[p]) hulls[p].append(QPointF(point.x, point.y));
+    }
+    if (!partitions.empty()) {
+        float area = (bounds.ur.x - bounds.ll.x) * (bounds.ur.y - bounds.ll.y);
+        partitionExtent = std::sqrt(area / partitions.size());
+    }
+}
+
+// Pixels per design unit
+float DotWidget::getScale() const {
+    float dataWidth = bounds.ur.x - bounds.ll.x;
+    float dataHeight = bounds.ur.y - bounds.ll.y;
+    float fit = 1.0f;
+    if (dataWidth > 0 && dataHeight > 0) {
+        fit = std::min((width() - 20) / dataWidth, (height() - 20) / dataHeight);
+    }
+    return fit * zoom;
+}
+
+QPointF DotWidget::toScreen(float x, float y) const {
+    float scale = getScale();
+    return QPointF(width() / 2.0 + (x - viewCenter.x()) * scale,
+                   height() / 2.0 + (y - viewCenter.y()) * scale);
+}
+
+QPointF DotWidget::toWorld(const QPointF& p) const {
+    float scale = getScale();
+    return QPointF(viewCenter.x() + (p.x() - width() / 2.0) / scale,
+                   viewCenter.y() + (p.y() - height() / 2.0) / scale);
+}
+
+BoundingBox DotWidget::getVisibleBox() const {
+    QPointF ll = toWorld(QPointF(0, 0));
+    QPointF ur = toWorld(QPointF(width(), height()));
+    return BoundingBox(std::max<float>(ll.x(), bounds.ll.x), std::max<float>(ll.y(), bounds.ll.y),
+                       std::min<float>(ur.x(), bounds.ur.x), std::min<float>(ur.y(), bounds.ur.y));
+}
+
+void DotWidget::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    BoundingBox visible = getVisibleBox();
+    float scale = getScale();
+
+    // Estimate the visible instance count from the visible share of the design
+    float dataArea = (bounds.ur.x - bounds.ll.x) * (bounds.ur.y - bounds.ll.y);
+    float visibleArea = std::max(0.0f, visible.ur.x - visible.ll.x) * std::max(0.0f, visible.ur.y - visible.ll.y);
+    float visibleCount = dataArea > 0 ? grid.getInstances().size() * visibleArea / dataArea
+                                      : static_cast<float>(grid.getInstances().size());
+
+    const char* mode;
+    if (!partitions.empty() && partitionExtent * scale < hullModeExtent) {
+        mode = "hulls";
+        drawHulls(painter, visible);
+    } else if (visibleCount <= directDrawLimit || pyramid.empty()) {
+        mode = "instances";
+        drawInstances(painter, visible);
+    } else {
+        mode = "raster";
+        drawRaster(painter, visible);
     }
 
     // Draw scale text at the bottom
     painter.setPen(Qt::blue);
-    QString scaleText = QString("X: [%1, %2], Y: [%3, %4]")
-        .arg(minX).arg(maxX).arg(minY).arg(maxY);
+    QString scaleText = QString("X: [%1, %2], Y: [%3, %4], zoom %5x, %6")
+        .arg(bounds.ll.x).arg(bounds.ur.x).arg(bounds.ll.y).arg(bounds.ur.y)
+        .arg(zoom).arg(mode);
     painter.drawText(10, height() - 10, scaleText);
 }
 
+// Draws the visible part of the coarsest level that still has a pixel per screen pixel
+void DotWidget::drawRaster(QPainter& painter, const BoundingBox& visible) {
+    if (visible.ur.x <= visible.ll.x || visible.ur.y <= visible.ll.y) return;
+    float scale = getScale();
+    size_t levelIndex = 0;
+    while (levelIndex + 1 < pyramid.size() && pyramidScale / (1 << (levelIndex + 1)) >= scale) ++levelIndex;
+    const QImage& level = pyramid[levelIndex];
+    float levelScale = pyramidScale / (1 << levelIndex);
+
+    QRectF source((visible.ll.x - bounds.ll.x) * levelScale, (visible.ll.y - bounds.ll.y) * levelScale,
+                  (visible.ur.x - visible.ll.x) * levelScale, (visible.ur.y - visible.ll.y) * levelScale);
+    QRectF target(toScreen(visible.ll.x, visible.ll.y), toScreen(visible.ur.x, visible.ur.y));
+    painter.drawImage(target, level, source);
+}
+
+void DotWidget::drawHulls(QPainter& painter, const BoundingBox& visible) {
+    painter.setRenderHint(QPainter::Antialiasing, false);
+    QRectF visibleRect(QPointF(visible.ll.x, visible.ll.y), QPointF(visible.ur.x, visible.ur.y));
+    float scale = getScale();
+
+    painter.save();
+    painter.translate(width() / 2.0 - viewCenter.x() * scale, height() / 2.0 - viewCenter.y() * scale);
+    painter.scale(scale, scale);
+    for (size_t p = 0; p < hulls.size(); ++p) {
+        if (hulls[p].isEmpty()) continue;
+        // Degenerate hulls have an empty bounding rect, compare the edges instead
+        QRectF hullRect = hulls[p].boundingRect();
+        if (hullRect.left() > visibleRect.right() || hullRect.right() < visibleRect.left() ||
+            hullRect.top() > visibleRect.bottom() || hullRect.bottom() < visibleRect.top()) continue;
+        QColor color = partitionColor(static_cast<std::uint32_t>(p));
+        QColor fill = color;
+        fill.setAlpha(110);
+        painter.setPen(QPen(color, 0));
+        painter.setBrush(fill);
+        painter.drawPolygon(hulls[p]);
+    }
+    painter.restore();
+
+    // Centroids, a pixel or two each
+    for (size_t p = 0; p < partitions.size(); ++p) {
+        const Point2D& center = partitions[p].centerLoc;
+        if (center.x < visible.ll.x || center.x > visible.ur.x || center.y < visible.ll.y || center.y > visible.ur.y) continue;
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(partitionColor(static_cast<std::uint32_t>(p)));
+        painter.drawEllipse(toScreen(center.x, center.y), 1.5, 1.5);
+    }
+}
+
+// Few enough instances are visible to draw each of them
+void DotWidget::drawInstances(QPainter& painter, const BoundingBox& visible) {
+    painter.setRenderHint(QPainter::Antialiasing);
+    const InstanceTable& table = grid.getInstances();
+    std::uint32_t current = noPartition - 1;
+    grid.forEachInstanceWithin(visible, [&](InstanceId id) {
+        std::uint32_t partition = partitionOf[id];
+        if (partition != current) {
+            painter.setPen(partitionColor(partition));
+            painter.setBrush(partitionColor(partition));
+            current = partition;
+        }
+        painter.drawEllipse(toScreen(table.getX(id), table.getY(id)), 2, 2);
+    });
+}
+
+void DotWidget::wheelEvent(QWheelEvent* event) {
+    // Zoom around the cursor
+    QPointF anchor = toWorld(event->position());
+    float factor = std::pow(1.0015f, static_cast<float>(event->angleDelta().y()));
+    zoom = std::min(std::max(zoom * factor, 0.25f), 100000.0f);
+    QPointF moved = toWorld(event->position());
+    viewCenter += anchor - moved;
+    update();
+}
+
+void DotWidget::mousePressEvent(QMouseEvent* event) {
+    lastMouse = event->position();
+}
+
+void DotWidget::mouseMoveEvent(QMouseEvent* event) {
+    if (!(event->buttons() & Qt::LeftButton)) return;
+    float scale = getScale();
+    QPointF delta = event->position() - lastMouse;
+    viewCenter -= delta / scale;
+    lastMouse = event->position();
+    update();
+}
+
+// Back to the whole design
+void DotWidget::mouseDoubleClickEvent(QMouseEvent*) {
+    zoom = 1.0f;
+    viewCenter = QPointF((bounds.ll.x + bounds.ur.x) / 2, (bounds.ll.y + bounds.ur.y) / 2);
+    update();
+}
@@ -0,0 +1,154 @@
+#include "instanceFile.hpp"
+#include "instanceGrid.hpp"
+#include "testCheck.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <limits>
+#include <random>
+
+// Binary files hold the live rows of a grid in id order. Bounds and totals
+// come from the columns, so removed rows and a stale header do not leak in.
+
+namespace {
+
+struct Row {
+    std::string name;
+    float x, y;
+    unsigned int bitsize;
+
+    bool operator==(const Row& other) const {
+        return name == other.name && x == other.x && y == other.y && bitsize == other.bitsize;
+    }
+};
+
+std::vector<Row> getLiveRows(const InstanceGrid& grid) {
+    const InstanceTable& table = grid.getInstances();
+    std::vector<Row> rows;
+    for (InstanceId id = 0; id < table.size(); ++id) {
+        if (!grid.isRemoved(id)) {
+            rows.push_back({std::string(table.getName(id)), table.getX(id), table.getY(id), table.getBitsize(id)});
+        }
+    }
+    return rows;
+}
+
+// Bounds and totals must match the rows, whatever the grid saw before
+void checkSummary(const InstanceGrid& grid, const std::vector<Row>& rows) {
+    size_t totalBitSize = 0;
+    unsigned int maxBitSize = 0;
+    BoundingBox bounds(rows[0].x, rows[0].y, rows[0].x, rows[0].y);
+    for (const Row& row : rows) {
+        totalBitSize += row.bitsize;
+        maxBitSize = std::max(maxBitSize, row.bitsize);
+        bounds.ll.x = std::min(bounds.ll.x, row.x);
+        bounds.ll.y = std::min(bounds.ll.y, row.y);
+        bounds.ur.x = std::max(bounds.ur.x, row.x);
+        bounds.ur.y = std::max(bounds.ur.y, row.y);
+    }
+    CHECK(grid.getInstanceCount() == rows.size());
+    CHECK(grid.getTotalBitSize() == totalBitSize);
+    CHECK(grid.getMaxBitSize() == maxBitSize);
+    CHECK(grid.getBounds().ll.x == bounds.ll.x && grid.getBounds().ll.y == bounds.ll.y);
+    CHECK(grid.getBounds().ur.x == bounds.ur.x && grid.getBounds().ur.y == bounds.ur.y);
+}
+
+// Every live row must be found through the bin index
+void checkBinned(const InstanceGrid& grid) {
+    size_t binned = 0;
+    grid.forEachInstanceWithin(grid.getBounds(), [&](InstanceId) { ++binned; });
+    CHECK(binned == grid.getInstanceCount());
+}
+
+template<typename T>
+void patchFile(const std::string& filename, size_t offset, const T& value) {
+    std::fstream file(filename, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}
+
+int main() {
+    std::string filename = getTestFilePath("binaryFileTest.bin");
+
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<float> coord(0.0f, 500.0f);
+    std::uniform_int_distribution<unsigned int> bits(0, 8);
+    InstanceGrid grid(20.0f);
+    for (int i = 0; i < 5000; ++i) {
+        grid.addInstance("inst_" + std::to_string(i % 4000), coord(rng), coord(rng), bits(rng));
+    }
+    // An outlier and the largest bitsize are removed, the file must not remember them
+    InstanceId outlier = grid.addInstance("outlier", 5000.0f, -5000.0f, 64);
+    grid.removeInstance(outlier);
+    for (InstanceId id = 0; id < 5000; id += 7) grid.removeInstance(id);
+    for (InstanceId id = 3; id < 5000; id += 11) {
+        if (!grid.isRemoved(id)) grid.moveInstance(id, coord(rng), coord(rng));
+    }
+    std::vector<Row> rows = getLiveRows(grid);
+
+    CHECK(grid.writeBinaryFile(filename));
+    {
+        InstanceGrid loaded(20.0f);
+        CHECK(loaded.readBinaryFile(filename));
+        CHECK(getLiveRows(loaded) == rows);
+        checkSummary(loaded, rows);
+        checkBinned(loaded);
+
+        // The header agrees with the columns
+        InstanceFileHeader header;
+        CHECK(readInstanceFileHeader(filename, header));
+        CHECK(header.count == rows.size());
+        CHECK(header.totalBitSize == loaded.getTotalBitSize());
+        CHECK(header.maxBitSize == loaded.getMaxBitSize());
+        CHECK(header.minX == loaded.getBounds().ll.x && header.minY == loaded.getBounds().ll.y);
+        CHECK(header.maxX == loaded.getBounds().ur.x && header.maxY == loaded.getBounds().ur.y);
+    }
+
+    // Appending to a grid that already holds instances keeps both
+    {
+        InstanceGrid loaded(20.0f);
+        loaded.addInstance("first", 1.0f, 2.0f, 3);
+        CHECK(loaded.readBinaryFile(filename));
+        std::vector<Row> expected = {{"first", 1.0f, 2.0f, 3}};
+        expected.insert(expected.end(), rows.begin(), rows.end());
+        CHECK(getLiveRows(loaded) == expected);
+        checkSummary(loaded, expected);
+        checkBinned(loaded);
+    }
+
+    // A header whose bounds and totals lie does not change what is loaded
+    patchFile(filename, offsetof(InstanceFileHeader, totalBitSize), std::uint64_t(1));
+    patchFile(filename, offsetof(InstanceFileHeader, maxBitSize), std::uint32_t(1));
+    patchFile(filename, offsetof(InstanceFileHeader, minX), 250.0f);
+    patchFile(filename, offsetof(InstanceFileHeader, maxY), 250.0f);
+    {
+        InstanceGrid loaded(20.0f);
+        CHECK(loaded.readBinaryFile(filename));
+        CHECK(getLiveRows(loaded) == rows);
+        checkSummary(loaded, rows);
+        checkBinned(loaded);
+
+        InstanceFileHeader summary;
+        CHECK(readInstanceFileSummary(filename, summary));
+        CHECK(summary.totalBitSize == loaded.getTotalBitSize());
+        CHECK(summary.minX == loaded.getBounds().ll.x);
+    }
+
+    // Non-finite coordinates and truncated files are rejected
+    {
+        InstanceFileHeader header;
+        CHECK(readInstanceFileHeader(filename, header));
+        patchFile(filename, header.xOffset, std::numeric_limits<float>::quiet_NaN());
+        InstanceGrid loaded(20.0f);
+        CHECK(!loaded.readBinaryFile(filename));
+        CHECK(loaded.getInstanceCount() == 0);
+
+        std::filesystem::resize_file(filename, header.namesOffset);
+        CHECK(!loaded.readBinaryFile(filename));
+    }
+
+    std::filesystem::remove(filename);
+    return getCheckResult();
+}
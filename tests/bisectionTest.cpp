@@ -0,0 +1,20 @@
+#include "limitCases.hpp"
+
+// Bisection gives each side its share of the partitions planned with the
+// largest bitsize as margin. It adds partitions only where a split leaves a
+// part over the limit, so it stays close to the planned count.
+
+int main() {
+    forEachLimitCase([](const char* label, InstanceGrid& grid, unsigned int bitsizeLimit) {
+        checkLimitCase(label, grid, bitsizeLimit, &Partitioner::partitionBisection);
+
+        Partitioner partitioner(grid, bitsizeLimit);
+        partitioner.partitionBisection();
+        size_t partitionBits = bitsizeLimit > grid.getMaxBitSize() ? bitsizeLimit - grid.getMaxBitSize() : 1;
+        size_t planned = std::max<size_t>(1, (grid.getTotalBitSize() + partitionBits - 1) / partitionBits);
+        size_t failures = checkFailures;
+        CHECK(partitioner.getPartitions().size() <= planned + planned / 50);
+        if (checkFailures != failures) std::fprintf(stderr, "  in case \"%s\", limit %u\n", label, bitsizeLimit);
+    });
+    return getCheckResult();
+}
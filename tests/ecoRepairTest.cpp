@@ -0,0 +1,162 @@
+#include "partitioner.hpp"
+#include "testCheck.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+// repairPartitions after moves, removals and additions, against a full
+// localized run on the changed design. The repair must stay valid, keep
+// the partitions away from the changes as they were and route about as
+// well as the re-run.
+
+namespace {
+
+bool isInside(const BoundingBox& box, const Point2D& p) {
+    return p.x >= box.ll.x && p.x <= box.ur.x && p.y >= box.ll.y && p.y <= box.ur.y;
+}
+
+double getNearestNeighbourLength(const Partitioner& partitioner) {
+    return partitioner.getRoutingMetrics().nearestNeighbour;
+}
+
+}
+
+int main() {
+    constexpr unsigned int bitsizeLimit = 200;
+    std::mt19937 rng(18);
+    std::uniform_real_distribution<float> coord(0.0f, 2000.0f);
+    std::uniform_real_distribution<float> nudge(-5.0f, 5.0f);
+    std::uniform_int_distribution<unsigned int> bits(0, 8);
+
+    InstanceGrid grid(25.0f);
+    constexpr size_t count = 20000;
+    for (size_t i = 0; i < count; ++i) grid.addInstance("inst_" + std::to_string(i), coord(rng), coord(rng), bits(rng));
+    Partitioner partitioner(grid, bitsizeLimit);
+    partitioner.partitionLocalized();
+    CHECK(partitioner.validate().isValid());
+
+    // No deltas, nothing changes
+    std::vector<std::vector<InstanceId>> before;
+    for (const auto& partition : partitioner.getPartitions()) before.push_back(partition.instances);
+    EcoRepairStats stats = partitioner.repairPartitions({});
+    CHECK(stats.touchedPartitions == 0 && stats.newPartitions == 0);
+    CHECK(partitioner.getPartitions().size() == before.size());
+    for (size_t p = 0; p < before.size(); ++p) CHECK(partitioner.getPartitions()[p].instances == before[p]);
+
+    // About 2% of the design: small nudges, far moves, removals, additions,
+    // and instances moved and then removed in the same ECO
+    std::vector<InstanceDelta> deltas;
+    std::uniform_int_distribution<InstanceId> anyId(0, static_cast<InstanceId>(count - 1));
+    std::vector<char> removed(count, 0);
+    // The ECO changes one corner of the design
+    std::uniform_real_distribution<float> ecoCoord(0.0f, 500.0f);
+    BoundingBox ecoBox(0.0f, 0.0f, 500.0f, 500.0f);
+    auto pickLive = [&]() {
+        InstanceId id;
+        do id = anyId(rng); while (removed[id] || !isInside(ecoBox, grid.getInstances().getLocation(id)));
+        return id;
+    };
+    for (int i = 0; i < 200; ++i) {
+        InstanceDelta delta;
+        delta.id = pickLive();
+        delta.x = grid.getInstances().getX(delta.id) + nudge(rng);
+        delta.y = grid.getInstances().getY(delta.id) + nudge(rng);
+        deltas.push_back(delta);
+    }
+    for (int i = 0; i < 50; ++i) {
+        InstanceDelta delta;
+        delta.id = pickLive();
+        delta.x = ecoCoord(rng);
+        delta.y = ecoCoord(rng);
+        deltas.push_back(delta);
+    }
+    for (int i = 0; i < 100; ++i) {
+        InstanceDelta delta;
+        delta.kind = InstanceDelta::Kind::Remove;
+        delta.id = pickLive();
+        removed[delta.id] = 1;
+        deltas.push_back(delta);
+    }
+    for (int i = 0; i < 100; ++i) {
+        InstanceDelta delta;
+        delta.kind = InstanceDelta::Kind::Add;
+        delta.name = "eco_" + std::to_string(i);
+        delta.x = ecoCoord(rng);
+        delta.y = ecoCoord(rng);
+        delta.bitsize = bits(rng);
+        deltas.push_back(delta);
+    }
+    for (int i = 0; i < 20; ++i) {
+        InstanceDelta move;
+        move.id = pickLive();
+        move.x = ecoCoord(rng);
+        move.y = ecoCoord(rng);
+        deltas.push_back(move);
+        InstanceDelta remove;
+        remove.kind = InstanceDelta::Kind::Remove;
+        remove.id = move.id;
+        removed[move.id] = 1;
+        deltas.push_back(remove);
+    }
+
+    stats = partitioner.repairPartitions(deltas);
+    PartitionValidation report = partitioner.validate();
+    CHECK(report.isValid());
+    CHECK(grid.getInstanceCount() == count - 120 + 100);
+    CHECK(stats.addedIds.size() == 100);
+    for (size_t i = 0; i < stats.addedIds.size(); ++i) {
+        CHECK(grid.getInstances().getName(stats.addedIds[i]) == "eco_" + std::to_string(i));
+    }
+
+    // Partitions keep their index and only the touched ones change. The
+    // repair searches a few bins around the changes, partitions further
+    // away must be exactly as they were.
+    const auto& repaired = partitioner.getPartitions();
+    CHECK(repaired.size() == before.size() + stats.newPartitions);
+    float reach = 8 * grid.getBinSize();
+    BoundingBox reachBox(ecoBox.ll.x - reach, ecoBox.ll.y - reach, ecoBox.ur.x + reach, ecoBox.ur.y + reach);
+    size_t changed = 0;
+    for (size_t p = 0; p < before.size(); ++p) {
+        // A moved instance that returns to its partition changes the order but not the membership
+        std::vector<InstanceId> members = repaired[p].instances;
+        std::sort(members.begin(), members.end());
+        std::sort(before[p].begin(), before[p].end());
+        changed += members != before[p];
+        bool nearEco = false;
+        for (InstanceId id : before[p]) nearEco = nearEco || isInside(reachBox, grid.getInstances().getLocation(id));
+        if (!nearEco) CHECK(members == before[p]);
+    }
+    CHECK(changed <= stats.touchedPartitions);
+
+    // Close to a full run on the changed design
+    Partitioner rerun(grid, bitsizeLimit);
+    rerun.partitionLocalized();
+    CHECK(rerun.validate().isValid());
+    double repairedLength = getNearestNeighbourLength(partitioner);
+    double rerunLength = getNearestNeighbourLength(rerun);
+    std::printf("partitions %zu vs %zu, nearest neighbour %.0f vs %.0f, changed %zu touched %zu\n",
+                repaired.size(), rerun.getPartitions().size(), repairedLength, rerunLength, changed,
+                stats.touchedPartitions);
+    CHECK(repairedLength <= rerunLength * 1.05);
+    CHECK(repaired.size() <= rerun.getPartitions().size() + stats.newPartitions);
+
+    // Removing the largest instance gives the partitioners their margin back
+    InstanceDelta heavy;
+    heavy.kind = InstanceDelta::Kind::Add;
+    heavy.name = "heavy";
+    heavy.x = heavy.y = 100.0f;
+    heavy.bitsize = 150;
+    InstanceId heavyId = partitioner.repairPartitions({heavy}).addedIds[0];
+    CHECK(grid.getMaxBitSize() == 150);
+    InstanceDelta removeHeavy;
+    removeHeavy.kind = InstanceDelta::Kind::Remove;
+    removeHeavy.id = heavyId;
+    partitioner.repairPartitions({removeHeavy});
+    CHECK(partitioner.validate().isValid());
+    CHECK(grid.getMaxBitSize() == 8);
+    Partitioner afterHeavy(grid, bitsizeLimit);
+    afterHeavy.partitionLocalized();
+    CHECK(afterHeavy.getPartitions().size() == rerun.getPartitions().size());
+
+    return getCheckResult();
+}
@@ -0,0 +1,18 @@
+#include "limitCases.hpp"
+
+// Hilbert cuts the curve every (limit - largest bitsize) bits of prefix, so
+// no chunk exceeds the limit and the chunk count is known in advance.
+
+int main() {
+    forEachLimitCase([](const char* label, InstanceGrid& grid, unsigned int bitsizeLimit) {
+        checkLimitCase(label, grid, bitsizeLimit, &Partitioner::partitionHilbert);
+
+        Partitioner partitioner(grid, bitsizeLimit);
+        partitioner.partitionHilbert();
+        size_t chunkBits = bitsizeLimit > grid.getMaxBitSize() ? bitsizeLimit - grid.getMaxBitSize() : 1;
+        size_t failures = checkFailures;
+        CHECK(partitioner.getPartitions().size() <= grid.getTotalBitSize() / chunkBits + 1);
+        if (checkFailures != failures) std::fprintf(stderr, "  in case \"%s\", limit %u\n", label, bitsizeLimit);
+    });
+    return getCheckResult();
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "partitioner.hpp"
+#include "testCheck.hpp"
+#include <random>
+
+// Designs that stress the bitsize limit of the curve and bisection
+// partitioners: clusters, zero and oversized bitsizes, collinear and
+// stacked instances, removed rows and limits at or below the largest bitsize.
+// fn(label, grid, bitsizeLimit) runs once per case.
+template<typename Fn>
+void forEachLimitCase(Fn&& fn) {
+    std::mt19937 rng(2025);
+    std::uniform_real_distribution<float> coord(0.0f, 1000.0f);
+    std::uniform_int_distribution<unsigned int> bits(0, 8);
+
+    {
+        InstanceGrid grid(20.0f);
+        for (int i = 0; i < 30000; ++i) grid.addInstance("u", coord(rng), coord(rng), bits(rng));
+        for (unsigned int limit : {9u, 16u, 100u, 1000u}) fn("uniform", grid, limit);
+        fn("limit at the largest bitsize", grid, 8);
+        fn("limit below the largest bitsize", grid, 5);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        std::normal_distribution<float> spread(0.0f, 15.0f);
+        for (int c = 0; c < 20; ++c) {
+            float cx = coord(rng), cy = coord(rng);
+            for (int i = 0; i < 1500; ++i) grid.addInstance("c", cx + spread(rng), cy + spread(rng), bits(rng));
+        }
+        fn("clustered", grid, 100);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        std::uniform_int_distribution<unsigned int> heavy(0, 300);
+        for (int i = 0; i < 5000; ++i) grid.addInstance("h", coord(rng), coord(rng), heavy(rng));
+        fn("wide bitsizes", grid, 1000);
+        fn("some instances over the limit", grid, 250);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        for (int i = 0; i < 5000; ++i) grid.addInstance("z", coord(rng), coord(rng), 0);
+        fn("zero bitsizes", grid, 100);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        for (int i = 0; i < 5000; ++i) grid.addInstance("l", 3.0f, coord(rng), bits(rng));
+        fn("collinear", grid, 100);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        for (int i = 0; i < 5000; ++i) grid.addInstance("s", 42.0f, 42.0f, bits(rng));
+        fn("stacked", grid, 100);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        grid.addInstance("one", 1.0f, 2.0f, 7);
+        fn("single instance", grid, 100);
+    }
+    {
+        InstanceGrid grid(20.0f);
+        for (int i = 0; i < 20000; ++i) grid.addInstance("r", coord(rng), coord(rng), bits(rng));
+        grid.addInstance("removed outlier", 1e6f, 1e6f, 500);
+        std::uniform_int_distribution<InstanceId> anyId(0, 20000);
+        for (int i = 0; i < 3000; ++i) grid.removeInstance(anyId(rng));
+        grid.removeInstance(20000);
+        fn("removed rows", grid, 100);
+    }
+}
+
+// Partitions on one thread, checks what holds for every limit respecting
+// partitioner and that more threads give the same partitions
+inline void checkLimitCase(const char* label, InstanceGrid& grid, unsigned int bitsizeLimit,
+                           void (Partitioner::*method)()) {
+    Partitioner partitioner(grid, bitsizeLimit);
+    partitioner.setThreadCount(1);
+    (partitioner.*method)();
+    const auto& partitions = partitioner.getPartitions();
+    PartitionValidation report = partitioner.validate();
+    size_t failures = checkFailures;
+
+    CHECK(report.missedInstances == 0);
+    CHECK(report.duplicateInstances == 0);
+    CHECK(report.removedInstances == 0);
+    CHECK(report.emptyPartitions.empty());
+    // Only a partition holding an instance above the limit may exceed it
+    const InstanceTable& table = grid.getInstances();
+    for (size_t p : report.overLimitPartitions) {
+        bool oversized = false;
+        for (InstanceId id : partitions[p].instances) oversized = oversized || table.getBitsize(id) > bitsizeLimit;
+        CHECK(oversized);
+    }
+    size_t lowerBound = bitsizeLimit ? (grid.getTotalBitSize() + bitsizeLimit - 1) / bitsizeLimit : 0;
+    CHECK(partitions.size() >= std::max<size_t>(lowerBound, 1));
+
+    Partitioner threaded(grid, bitsizeLimit);
+    threaded.setThreadCount(4);
+    (threaded.*method)();
+    CHECK(threaded.getPartitions().size() == partitions.size());
+    for (size_t p = 0; p < std::min(partitions.size(), threaded.getPartitions().size()); ++p) {
+        CHECK(threaded.getPartitions()[p].instances == partitions[p].instances);
+    }
+
+    if (checkFailures != failures) std::fprintf(stderr, "  in case \"%s\", limit %u\n", label, bitsizeLimit);
+}
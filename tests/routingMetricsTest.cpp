@@ -0,0 +1,127 @@
+#include "routingMetrics.hpp"
+#include "testCheck.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+// The octant sweep MST and the grid nearest neighbour against plain O(k^2)
+// scans. Designs above the dense Prim limit take the sweep, integer
+// coordinates make every length exact so ties must resolve the same way.
+
+namespace {
+
+double manhattan(const InstanceTable& table, InstanceId a, InstanceId b) {
+    return std::fabs(double(table.getX(a)) - table.getX(b)) + std::fabs(double(table.getY(a)) - table.getY(b));
+}
+
+double referenceSpanningTree(const InstanceTable& table, const std::vector<InstanceId>& ids) {
+    std::vector<double> dist(ids.size(), std::numeric_limits<double>::max());
+    std::vector<char> inTree(ids.size(), 0);
+    double total = 0;
+    size_t last = 0;
+    inTree[0] = 1;
+    for (size_t added = 1; added < ids.size(); ++added) {
+        size_t best = 0;
+        double bestDist = std::numeric_limits<double>::max();
+        for (size_t j = 0; j < ids.size(); ++j) {
+            if (inTree[j]) continue;
+            dist[j] = std::min(dist[j], manhattan(table, ids[last], ids[j]));
+            if (dist[j] < bestDist) {
+                bestDist = dist[j];
+                best = j;
+            }
+        }
+        total += bestDist;
+        inTree[best] = 1;
+        last = best;
+    }
+    return total;
+}
+
+double referenceNearestNeighbour(const InstanceTable& table, const std::vector<InstanceId>& ids) {
+    double total = 0;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        double nearest = std::numeric_limits<double>::max();
+        for (size_t j = 0; j < ids.size(); ++j) {
+            if (i != j) nearest = std::min(nearest, manhattan(table, ids[i], ids[j]));
+        }
+        total += nearest;
+    }
+    return total;
+}
+
+bool isClose(double value, double expected, bool exact) {
+    if (exact) return value == expected;
+    return std::fabs(value - expected) <= 1e-5 * std::max(1.0, std::fabs(expected));
+}
+
+void checkDesign(const InstanceTable& table, const std::vector<InstanceId>& ids, bool exact) {
+    CHECK(isClose(measureSpanningTreeLength(table, ids.data(), ids.size()), referenceSpanningTree(table, ids), exact));
+    CHECK(isClose(measureNearestNeighbourLength(table, ids.data(), ids.size()),
+                  referenceNearestNeighbour(table, ids), exact));
+}
+
+}
+
+int main() {
+    std::mt19937 rng(11);
+    std::vector<size_t> sizes = {2, 3, 40, 1000, 1025, 1500, 3000};
+
+    for (size_t count : sizes) {
+        // Uniform float coordinates
+        {
+            InstanceTable table;
+            std::uniform_real_distribution<float> coord(0.0f, 1000.0f);
+            std::vector<InstanceId> ids;
+            for (size_t i = 0; i < count; ++i) ids.push_back(table.add("u", coord(rng), coord(rng), 1));
+            checkDesign(table, ids, false);
+        }
+        // Clustered on a coarse lattice: duplicate points and equal distances everywhere
+        {
+            InstanceTable table;
+            std::uniform_int_distribution<int> coord(0, 40);
+            std::vector<InstanceId> ids;
+            for (size_t i = 0; i < count; ++i) {
+                ids.push_back(table.add("l", float(coord(rng)), float(coord(rng) / 4 * 4), 1));
+            }
+            checkDesign(table, ids, true);
+        }
+        // Collinear, vertical and diagonal
+        {
+            InstanceTable table;
+            std::uniform_int_distribution<int> coord(0, 100000);
+            std::vector<InstanceId> vertical, diagonal;
+            for (size_t i = 0; i < count; ++i) {
+                vertical.push_back(table.add("v", 7.0f, float(coord(rng)), 1));
+                int d = coord(rng);
+                diagonal.push_back(table.add("d", float(d), float(-d), 1));
+            }
+            checkDesign(table, vertical, true);
+            checkDesign(table, diagonal, true);
+        }
+    }
+
+    // Only the given ids count, not the rest of the table
+    {
+        InstanceTable table;
+        std::uniform_int_distribution<int> coord(0, 5000);
+        std::vector<InstanceId> ids;
+        for (size_t i = 0; i < 4000; ++i) {
+            InstanceId id = table.add("s", float(coord(rng)), float(coord(rng)), 1);
+            if (i % 3 == 0) ids.push_back(id);
+        }
+        checkDesign(table, ids, true);
+
+        double minX = 1e30, minY = 1e30, maxX = -1e30, maxY = -1e30;
+        for (InstanceId id : ids) {
+            minX = std::min<double>(minX, table.getX(id));
+            minY = std::min<double>(minY, table.getY(id));
+            maxX = std::max<double>(maxX, table.getX(id));
+            maxY = std::max<double>(maxY, table.getY(id));
+        }
+        CHECK(measureHalfPerimeter(table, ids.data(), ids.size()) == (maxX - minX) + (maxY - minY));
+    }
+
+    return getCheckResult();
+}
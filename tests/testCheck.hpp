@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+// Minimal checks for the behaviour tests. A failed check is reported and
+// counted, the test keeps going so one run shows every failure.
+inline int checkFailures = 0;
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++checkFailures;                                                          \
+        }                                                                             \
+    } while (0)
+
+// Exit code of a test's main
+inline int getCheckResult() {
+    if (checkFailures) std::fprintf(stderr, "%d check(s) failed\n", checkFailures);
+    return checkFailures ? 1 : 0;
+}
+
+// Scratch file in the temp directory, name it after the test so parallel runs do not collide
+inline std::string getTestFilePath(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
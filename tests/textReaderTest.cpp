@@ -0,0 +1,100 @@
+#include "instanceGrid.hpp"
+#include "testCheck.hpp"
+#include <fstream>
+#include <random>
+#include <sstream>
+
+// The memory mapped reader must accept exactly the lines the istream reader
+// did, with the same values, in file order.
+
+namespace {
+
+struct Row {
+    std::string name;
+    float x, y;
+    unsigned int bitsize;
+};
+
+// The reader readInstancesFromFile replaced
+std::vector<Row> readWithStream(const std::string& filename) {
+    std::vector<Row> rows;
+    std::ifstream infile(filename);
+    std::string line;
+    while (std::getline(infile, line)) {
+        std::istringstream iss(line);
+        Row row;
+        if (iss >> row.name >> row.x >> row.y >> row.bitsize) rows.push_back(row);
+    }
+    return rows;
+}
+
+std::vector<Row> readWithGrid(const std::string& filename) {
+    InstanceGrid grid(10.0f);
+    grid.readInstancesFromFile(filename);
+    const InstanceTable& table = grid.getInstances();
+    std::vector<Row> rows;
+    for (InstanceId id = 0; id < table.size(); ++id) {
+        rows.push_back({std::string(table.getName(id)), table.getX(id), table.getY(id), table.getBitsize(id)});
+    }
+    return rows;
+}
+
+void checkSameRows(const std::string& filename) {
+    std::vector<Row> expected = readWithStream(filename);
+    std::vector<Row> rows = readWithGrid(filename);
+    CHECK(rows.size() == expected.size());
+    for (size_t i = 0; i < std::min(rows.size(), expected.size()); ++i) {
+        CHECK(rows[i].name == expected[i].name);
+        CHECK(rows[i].x == expected[i].x);
+        CHECK(rows[i].y == expected[i].y);
+        CHECK(rows[i].bitsize == expected[i].bitsize);
+    }
+}
+
+}
+
+int main() {
+    std::string filename = getTestFilePath("textReaderTest.txt");
+
+    // Formatting the placement dumps have in practice, and lines both readers skip
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << "u_core/reg_0 1.5 2.25 4\n"
+               "  u_core/reg_1\t-3.0\t4e2\t0\n"
+               "u_core/reg_2 5 6 7\r\n"
+               "\n"
+               "   \t \n"
+               "u_core/reg_3 +7.5 +0.125 +2 trailing fields\n"
+               "u_core/reg_4 .5 1. 3\n"
+               "u_core/reg_5 1.5 2.5 3.9\n"
+               "u_core/reg_0 8 9 1\n"
+               "missing_bitsize 1 2\n"
+               "bad_x abc 2 3\n"
+               "bad_y 1 2y 3\n"
+               "too_large 1e40 2 3\n"
+               "just_a_name\n"
+               "u_core/last 100 200 8";
+    }
+    checkSameRows(filename);
+    CHECK(readWithGrid(filename).size() == 8);
+
+    // A larger random file
+    {
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> coord(-1000.0f, 1000.0f);
+        std::uniform_int_distribution<unsigned int> bits(0, 8);
+        std::ofstream out(filename, std::ios::binary);
+        out.precision(9);
+        for (int i = 0; i < 20000; ++i) {
+            out << "inst_" << i % 15000 << ' ' << coord(rng) << ' ' << coord(rng) << ' ' << bits(rng) << '\n';
+        }
+    }
+    checkSameRows(filename);
+
+    // Empty file
+    { std::ofstream out(filename, std::ios::binary); }
+    CHECK(readWithGrid(filename).empty());
+
+    std::filesystem::remove(filename);
+    return getCheckResult();
+}
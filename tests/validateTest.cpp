@@ -0,0 +1,117 @@
+#include "partitioner.hpp"
+#include "testCheck.hpp"
+#include <random>
+
+// Partitioner::validate on hand made and random assignments, against counts
+// taken directly from the assignment.
+
+namespace {
+
+struct Expected {
+    size_t missed = 0, duplicates = 0, removed = 0;
+    std::vector<size_t> overLimit, empty;
+};
+
+Expected countAssignment(const InstanceGrid& grid, const std::vector<std::vector<InstanceId>>& assignment,
+                         unsigned int bitsizeLimit) {
+    const InstanceTable& table = grid.getInstances();
+    std::vector<size_t> occurrences(table.size(), 0);
+    Expected expected;
+    for (size_t p = 0; p < assignment.size(); ++p) {
+        unsigned int bitsize = 0;
+        for (InstanceId id : assignment[p]) {
+            ++occurrences[id];
+            bitsize += table.getBitsize(id);
+        }
+        if (bitsize > bitsizeLimit) expected.overLimit.push_back(p);
+        if (assignment[p].empty()) expected.empty.push_back(p);
+    }
+    for (InstanceId id = 0; id < table.size(); ++id) {
+        if (occurrences[id] > 1) expected.duplicates += occurrences[id] - 1;
+        if (grid.isRemoved(id)) expected.removed += occurrences[id] > 0;
+        else expected.missed += occurrences[id] == 0;
+    }
+    return expected;
+}
+
+void checkReport(const PartitionValidation& report, const Expected& expected) {
+    CHECK(report.missedInstances == expected.missed);
+    CHECK(report.duplicateInstances == expected.duplicates);
+    CHECK(report.removedInstances == expected.removed);
+    CHECK(report.overLimitPartitions == expected.overLimit);
+    CHECK(report.emptyPartitions == expected.empty);
+    CHECK(report.isValid() == (expected.missed == 0 && expected.duplicates == 0 && expected.removed == 0 &&
+                               expected.overLimit.empty()));
+}
+
+}
+
+int main() {
+    constexpr unsigned int bitsizeLimit = 10;
+
+    // Ten instances of bitsize 2, one partition of five per half
+    {
+        InstanceGrid grid(10.0f);
+        for (int i = 0; i < 10; ++i) grid.addInstance("i" + std::to_string(i), float(i), 0.0f, 2);
+        Partitioner partitioner(grid, bitsizeLimit);
+
+        partitioner.setPartitions({{0, 1, 2, 3, 4}, {5, 6, 7, 8, 9}});
+        PartitionValidation report = partitioner.validate();
+        CHECK(report.isValid());
+        CHECK(report.emptyPartitions.empty());
+
+        // 9 missing, 0 repeated within a partition, 4 repeated across two, 0 over the limit
+        partitioner.setPartitions({{0, 0, 1, 2, 3, 4}, {4, 5, 6, 7, 8}, {}});
+        report = partitioner.validate();
+        CHECK(report.missedInstances == 1);
+        CHECK(report.duplicateInstances == 2);
+        CHECK(report.overLimitPartitions == std::vector<size_t>{0});
+        CHECK(report.emptyPartitions == std::vector<size_t>{2});
+        CHECK(!report.isValid());
+        CHECK(partitioner.countGridInstancesMissedInPartitions() == 1);
+        CHECK(partitioner.getViolatingBitLimitPartitionCount() == 1);
+
+        // Removed instances must leave their partition and are not missed
+        grid.removeInstance(3);
+        grid.removeInstance(9);
+        partitioner.setPartitions({{0, 1, 2, 3, 4}, {5, 6, 7, 8}});
+        report = partitioner.validate();
+        CHECK(report.removedInstances == 1);
+        CHECK(report.missedInstances == 0);
+        CHECK(!report.isValid());
+        partitioner.setPartitions({{0, 1, 2, 4}, {5, 6, 7, 8}});
+        CHECK(partitioner.validate().isValid());
+    }
+
+    // Random assignments with drops, repeats and removals, on one and several threads
+    std::mt19937 rng(12);
+    for (int trial = 0; trial < 20; ++trial) {
+        InstanceGrid grid(10.0f);
+        std::uniform_real_distribution<float> coord(0.0f, 100.0f);
+        std::uniform_int_distribution<unsigned int> bits(0, 4);
+        size_t count = 200 + 37 * trial;
+        for (size_t i = 0; i < count; ++i) grid.addInstance("r", coord(rng), coord(rng), bits(rng));
+        std::uniform_int_distribution<InstanceId> anyId(0, static_cast<InstanceId>(count - 1));
+        for (int i = 0; i < trial; ++i) grid.removeInstance(anyId(rng));
+
+        std::vector<std::vector<InstanceId>> assignment(count / 4 + 1);
+        std::uniform_int_distribution<size_t> anyPartition(0, assignment.size() - 1);
+        std::uniform_int_distribution<int> roll(0, 99);
+        for (InstanceId id = 0; id < count; ++id) {
+            if (grid.isRemoved(id) && roll(rng) < 80) continue;
+            if (roll(rng) < 5) continue;
+            assignment[anyPartition(rng)].push_back(id);
+            if (roll(rng) < 5) assignment[anyPartition(rng)].push_back(id);
+        }
+
+        Partitioner partitioner(grid, bitsizeLimit);
+        partitioner.setPartitions(assignment);
+        Expected expected = countAssignment(grid, assignment, bitsizeLimit);
+        for (size_t threads : {1, 4}) {
+            partitioner.setThreadCount(threads);
+            checkReport(partitioner.validate(), expected);
+        }
+    }
+
+    return getCheckResult();
+}